@@ -0,0 +1,457 @@
+/*
+ * File:        aggregates.c
+ * Project:     Crucible
+ * Description: Running per-user and global totals, the donor leaderboard and the
+ *              columnar donation copy with its SIMD reporting kernels.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#include "crucible.h"
+
+// --- Global State ---
+Aggregates aggregates = { .ready = false };
+DonationColumns columns = { .enabled = false };
+
+// --- Aggregates ---
+// Global and per-user totals per material, a leaderboard heap per material, the donation
+// timeline (see timeline.c) and each user's donation positions (see history.c). load_data
+// builds them once with a single pass over the donations; from then on add_donation keeps
+// them current, so totals, top-K, date-range queries and a user's history never scan the
+// donation table.
+
+static int64_t donor_key(const DonorHeap *heap, int user) {
+    return aggregates.per_user[user].kg[heap->material];
+}
+
+static void heap_swap(DonorHeap *heap, int a, int b) {
+    int user_a = heap->items[a];
+    int user_b = heap->items[b];
+    heap->items[a] = user_b;
+    heap->items[b] = user_a;
+    heap->position[user_b] = a;
+    heap->position[user_a] = b;
+}
+
+static void heap_sift_up(DonorHeap *heap, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (donor_key(heap, heap->items[parent]) >= donor_key(heap, heap->items[i])) break;
+        heap_swap(heap, parent, i);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(DonorHeap *heap, int i) {
+    while (true) {
+        int largest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < heap->count && donor_key(heap, heap->items[left]) > donor_key(heap, heap->items[largest])) largest = left;
+        if (right < heap->count && donor_key(heap, heap->items[right]) > donor_key(heap, heap->items[largest])) largest = right;
+        if (largest == i) return;
+        heap_swap(heap, i, largest);
+        i = largest;
+    }
+}
+
+// Re-positions a user whose total just changed, adding them on their first donation of the
+// heap's material. Totals never shrink, so a user with nothing of it stays out.
+static void heap_update(DonorHeap *heap, int user) {
+    int i = heap->position[user];
+    if (i < 0) {
+        if (donor_key(heap, user) == 0) return;
+        i = heap->count++;
+        heap->items[i] = user;
+        heap->position[user] = i;
+    }
+    heap_sift_up(heap, i);
+    heap_sift_down(heap, heap->position[user]);
+}
+
+// Grows the per-user arrays to cover every registered user.
+static bool aggregates_reserve(int needed) {
+    if (needed <= aggregates.capacity) return true;
+
+    int capacity = aggregates.capacity ? aggregates.capacity : 1024;
+    while (capacity < needed) capacity *= 2;
+
+    MaterialTotals *per_user = realloc(aggregates.per_user, capacity * sizeof(MaterialTotals));
+    if (per_user == NULL) return false;
+    memset(per_user + aggregates.capacity, 0, (capacity - aggregates.capacity) * sizeof(MaterialTotals));
+    aggregates.per_user = per_user;
+
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        DonorHeap *heap = &aggregates.leaders[m];
+        int *items = realloc(heap->items, capacity * sizeof(int));
+        if (items == NULL) return false;
+        heap->items = items;
+        int *position = realloc(heap->position, capacity * sizeof(int));
+        if (position == NULL) return false;
+        heap->position = position;
+        for (int u = aggregates.capacity; u < capacity; u++) heap->position[u] = -1;
+    }
+    aggregates.capacity = capacity;
+    return true;
+}
+
+static void add_to_totals(MaterialTotals *totals, const Donation *donation) {
+    totals->kg[MATERIAL_PAPER] += donation->paper;
+    totals->kg[MATERIAL_PLASTIC] += donation->plastic;
+    totals->kg[MATERIAL_ALUMINUM] += donation->aluminum;
+}
+
+void aggregate_donation(const Donation *donation) {
+    add_to_totals(&aggregates.global, donation);
+
+    if (!aggregates_reserve(users.count)) return;
+    add_to_totals(&aggregates.per_user[donation->user], donation);
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        heap_update(&aggregates.leaders[m], (int)donation->user);
+    }
+}
+
+// Rebuilds the leaderboard heaps from the per-user totals with a bottom-up heapify: O(users)
+// instead of one sift per donation.
+void rebuild_leaders() {
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        DonorHeap *heap = &aggregates.leaders[m];
+        for (int i = 0; i < heap->count; i++) heap->position[heap->items[i]] = -1;
+        heap->count = 0;
+        for (int u = 0; u < users.count && u < aggregates.capacity; u++) {
+            if (aggregates.per_user[u].kg[m] == 0) continue; // nothing of this material
+            heap->position[u] = heap->count;
+            heap->items[heap->count++] = u;
+        }
+        for (int i = heap->count / 2 - 1; i >= 0; i--) {
+            heap_sift_down(heap, i);
+        }
+    }
+}
+
+// Adds the donations in [first, first + count) whose donor's center is set in centers (all
+// of them when centers is NULL) to the totals and the timeline. For merging a shard: the
+// caller rebuilds the leaders and merges the timeline once it is done.
+void aggregate_range(int first, int count, const bool *centers) {
+    if (!aggregates_reserve(users.count > 0 ? users.count : 1)) return;
+    for (int i = first; i < first + count; i++) {
+        const Donation *donation = donation_at(i);
+        if (centers != NULL && !centers[donation_center(donation)]) continue;
+        add_to_totals(&aggregates.global, donation);
+        add_to_totals(&aggregates.per_user[donation->user], donation);
+        user_history_append((int)donation->user, i);
+        timeline_append(donation, i);
+    }
+}
+
+// Counts the donations of the loaded centers (see shards.c), all of them by default.
+void build_aggregates() {
+    free_aggregates();
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        aggregates.leaders[m].material = m;
+    }
+    if (!aggregates_reserve(users.count > 0 ? users.count : 1)) return;
+
+    for (int i = shard_skip(0); i < donations.count; i = shard_skip(i + 1)) {
+        const Donation *donation = donation_at(i);
+        add_to_totals(&aggregates.global, donation);
+        add_to_totals(&aggregates.per_user[donation->user], donation);
+        user_history_append((int)donation->user, i);
+    }
+    rebuild_leaders();
+    timeline_build();
+    aggregates.ready = true;
+}
+
+void free_aggregates() {
+    free(aggregates.per_user);
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        free(aggregates.leaders[m].items);
+        free(aggregates.leaders[m].position);
+    }
+    timeline_free();
+    user_history_free();
+    memset(&aggregates, 0, sizeof(aggregates));
+}
+
+// Writes the positions of the k biggest donors of a material into out, best first, and
+// returns how many were found. Walks the heap best-first with a small frontier heap, so the
+// cost is O(k log k) no matter how many users there are.
+int top_donors(Material material, int k, int *out) {
+    const DonorHeap *heap = &aggregates.leaders[material];
+    if (!aggregates.ready || heap->count == 0 || k <= 0) return 0;
+    if (k > LEADERBOARD_MAX) k = LEADERBOARD_MAX;
+
+    int frontier[2 * LEADERBOARD_MAX + 1]; // indices into heap->items, max-heap by key
+    int frontier_count = 1;
+    int found = 0;
+    frontier[0] = 0;
+
+    while (found < k && frontier_count > 0) {
+        int best = frontier[0];
+        out[found++] = heap->items[best];
+
+        // pop the best, then push its two children
+        frontier[0] = frontier[--frontier_count];
+        int children[2] = { 2 * best + 1, 2 * best + 2 };
+        for (int c = 0; c < 2; c++) {
+            if (children[c] < heap->count) frontier[frontier_count++] = children[c];
+        }
+
+        // the frontier is tiny, a plain re-heapify keeps the code simple
+        for (int i = frontier_count / 2 - 1; i >= 0; i--) {
+            for (int j = i; ; ) {
+                int largest = j;
+                int left = 2 * j + 1;
+                int right = left + 1;
+                if (left < frontier_count && donor_key(heap, heap->items[frontier[left]]) > donor_key(heap, heap->items[frontier[largest]])) largest = left;
+                if (right < frontier_count && donor_key(heap, heap->items[frontier[right]]) > donor_key(heap, heap->items[frontier[largest]])) largest = right;
+                if (largest == j) break;
+                int tmp = frontier[j];
+                frontier[j] = frontier[largest];
+                frontier[largest] = tmp;
+                j = largest;
+            }
+        }
+    }
+    return found;
+}
+
+
+// --- Columnar Donations ---
+// Off until the first report asks for it; from then on add_donation appends to the columns
+// too. They start after the cold tier, whose block summaries already hold what the reports
+// need (see cold.c). The kernels below come in scalar, SSE4.1 and AVX2 flavours;
+// column_kernels() picks the widest one the CPU supports.
+
+static bool columns_reserve(int needed) {
+    if (needed <= columns.capacity) return true;
+
+    int capacity = columns.capacity ? columns.capacity : ARENA_CHUNK_SIZE;
+    while (capacity < needed) capacity *= 2;
+
+    int32_t **arrays[] = { &columns.paper, &columns.plastic, &columns.aluminum, &columns.user };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        int32_t *grown = realloc(*arrays[i], (size_t)capacity * sizeof(int32_t));
+        if (grown == NULL) return false;
+        *arrays[i] = grown;
+    }
+    columns.capacity = capacity;
+    return true;
+}
+
+bool columns_append(const Donation *donation) {
+    if (!columns_reserve(columns.count + 1)) {
+        columns_free(); // a stale copy is worse than none, rebuild on next use
+        return false;
+    }
+    columns.paper[columns.count] = donation->paper;
+    columns.plastic[columns.count] = donation->plastic;
+    columns.aluminum[columns.count] = donation->aluminum;
+    columns.user[columns.count] = (int32_t)donation->user;
+    columns.count++;
+    return true;
+}
+
+// Copies up to rows more donations into the columns; true once they cover the whole hot
+// tier, from then on add_donation keeps them in sync. The UI calls it while idle so the
+// first report doesn't have to wait for a full pass.
+bool columns_build_step(int rows) {
+    if (columns.enabled) return true;
+    if (columns.count == 0) columns.first = cold.count;
+    int total = donations.count - columns.first;
+    if (!columns_reserve(total > 0 ? total : 1)) {
+        columns_free();
+        return true; // nothing more a step can do; columns_enable reports the failure
+    }
+
+    int end = total - columns.count > rows ? columns.count + rows : total;
+    for (int row = columns.count; row < end; row++) {
+        const Donation *donation = donation_at(columns.first + row);
+        columns.paper[row] = donation->paper;
+        columns.plastic[row] = donation->plastic;
+        columns.aluminum[row] = donation->aluminum;
+        columns.user[row] = (int32_t)donation->user;
+    }
+    columns.count = end;
+    columns.enabled = end == total;
+    return columns.enabled;
+}
+
+// Finishes the columns in one go (whatever idle steps left over) and keeps them in sync.
+bool columns_enable() {
+    columns_build_step(INT_MAX);
+    return columns.enabled;
+}
+
+void columns_free() {
+    free(columns.paper);
+    free(columns.plastic);
+    free(columns.aluminum);
+    free(columns.user);
+    memset(&columns, 0, sizeof(columns));
+}
+
+const int32_t* material_column(Material material) {
+    switch (material) {
+        case MATERIAL_PAPER:   return columns.paper;
+        case MATERIAL_PLASTIC: return columns.plastic;
+        default:               return columns.aluminum;
+    }
+}
+
+static int64_t sum_scalar(const int32_t *values, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += values[i];
+    return sum;
+}
+
+static void min_max_scalar(const int32_t *values, size_t n, int32_t *min, int32_t *max) {
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+    for (size_t i = 0; i < n; i++) {
+        if (values[i] < lo) lo = values[i];
+        if (values[i] > hi) hi = values[i];
+    }
+    *min = lo;
+    *max = hi;
+}
+
+static size_t count_at_least_scalar(const int32_t *values, size_t n, int32_t threshold) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) count += values[i] >= threshold;
+    return count;
+}
+
+#ifdef HAVE_X86_KERNELS
+// Sums widen to 64-bit lanes so tens of millions of rows can't overflow. Counts compare
+// against threshold - 1 (there is no "greater or equal" compare) and subtract the all-ones
+// masks from 32-bit lane counters, which is safe because n itself fits in an int.
+
+__attribute__((target("sse4.1")))
+static int64_t sum_sse41(const int32_t *values, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(v));
+        acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return lanes[0] + lanes[1] + sum_scalar(values + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void min_max_sse41(const int32_t *values, size_t n, int32_t *min, int32_t *max) {
+    __m128i lo = _mm_set1_epi32(INT32_MAX);
+    __m128i hi = _mm_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        lo = _mm_min_epi32(lo, v);
+        hi = _mm_max_epi32(hi, v);
+    }
+    int32_t lo_lanes[4], hi_lanes[4];
+    _mm_storeu_si128((__m128i*)lo_lanes, lo);
+    _mm_storeu_si128((__m128i*)hi_lanes, hi);
+    min_max_scalar(values + i, n - i, min, max);
+    for (int l = 0; l < 4; l++) {
+        if (lo_lanes[l] < *min) *min = lo_lanes[l];
+        if (hi_lanes[l] > *max) *max = hi_lanes[l];
+    }
+}
+
+__attribute__((target("sse4.1")))
+static size_t count_at_least_sse41(const int32_t *values, size_t n, int32_t threshold) {
+    if (threshold == INT32_MIN) return n;
+    __m128i bound = _mm_set1_epi32(threshold - 1);
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, bound));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return (size_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_at_least_scalar(values + i, n - i, threshold);
+}
+
+__attribute__((target("avx2")))
+static int64_t sum_avx2(const int32_t *values, size_t n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(values + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void min_max_avx2(const int32_t *values, size_t n, int32_t *min, int32_t *max) {
+    __m256i lo = _mm256_set1_epi32(INT32_MAX);
+    __m256i hi = _mm256_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        lo = _mm256_min_epi32(lo, v);
+        hi = _mm256_max_epi32(hi, v);
+    }
+    int32_t lo_lanes[8], hi_lanes[8];
+    _mm256_storeu_si256((__m256i*)lo_lanes, lo);
+    _mm256_storeu_si256((__m256i*)hi_lanes, hi);
+    min_max_scalar(values + i, n - i, min, max);
+    for (int l = 0; l < 8; l++) {
+        if (lo_lanes[l] < *min) *min = lo_lanes[l];
+        if (hi_lanes[l] > *max) *max = hi_lanes[l];
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t count_at_least_avx2(const int32_t *values, size_t n, int32_t threshold) {
+    if (threshold == INT32_MIN) return n;
+    __m256i bound = _mm256_set1_epi32(threshold - 1);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(v, bound));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    size_t count = count_at_least_scalar(values + i, n - i, threshold);
+    for (int l = 0; l < 8; l++) count += lanes[l];
+    return count;
+}
+#endif
+
+const ColumnKernels* column_kernels() {
+    static const ColumnKernels scalar = { "escalar", sum_scalar, min_max_scalar, count_at_least_scalar };
+#ifdef HAVE_X86_KERNELS
+    static const ColumnKernels sse41 = { "SSE4.1", sum_sse41, min_max_sse41, count_at_least_sse41 };
+    static const ColumnKernels avx2 = { "AVX2", sum_avx2, min_max_avx2, count_at_least_avx2 };
+    static const ColumnKernels *selected = NULL;
+    if (selected == NULL) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) selected = &avx2;
+        else if (__builtin_cpu_supports("sse4.1")) selected = &sse41;
+        else selected = &scalar;
+    }
+    return selected;
+#else
+    return &scalar;
+#endif
+}
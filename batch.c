@@ -0,0 +1,282 @@
+/*
+ * File:        batch.c
+ * Project:     Crucible
+ * Description: Headless CSV import and export, used for the nightly batches from
+ *              the collection centers.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crucible.h"
+
+// --- Batch Mode ---
+// CSV interchange for the nightly paper-form batches. One row per line:
+//     numero_control,nombre,papel,plastico,aluminio[,fecha[,centro]]
+// A row with empty quantities only registers the user; otherwise it records a donation and
+// registers the user first if needed. fecha is local time, "AAAA-MM-DD[ HH:MM:SS]"; rows
+// without the column are dated at import, an empty fecha means undated (as exported).
+// centro is the collection center a new user is registered at; without it (or empty) they
+// go to the importing kiosk's center, as if registered there.
+// Fields may be double-quoted ("" escapes a quote).
+// Rows are streamed through a fixed buffer, so memory doesn't grow with the file size.
+
+#define CSV_FIELDS 7
+#define CSV_REQUIRED_FIELDS 5
+
+// Splits one CSV line in place. Returns the number of fields, or -1 on bad quoting.
+static int split_csv_line(char *line, char *fields[], int max_fields) {
+    int count = 0;
+    char *read = line;
+    while (count < max_fields) {
+        char *write = read;
+        fields[count++] = write;
+        if (*read == '"') {
+            read++;
+            while (true) {
+                if (*read == '\0') return -1;
+                if (*read == '"') {
+                    if (read[1] != '"') break;
+                    read++;
+                }
+                *write++ = *read++;
+            }
+            read++; // closing quote
+            if (*read != ',' && *read != '\0') return -1;
+        } else {
+            while (*read != ',' && *read != '\0') *write++ = *read++;
+        }
+        bool more = *read == ',';
+        *write = '\0';
+        if (!more) return count;
+        read++;
+    }
+    return count + 1; // too many fields
+}
+
+bool parse_quantity(const char* text, int *value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < 0 || parsed > INT32_MAX) return false;
+    *value = (int)parsed;
+    return true;
+}
+
+// Local date and optional time to epoch seconds; an empty field is an undated donation.
+static bool parse_date(const char* text, int64_t *timestamp) {
+    if (text[0] == '\0') {
+        *timestamp = 0;
+        return true;
+    }
+    struct tm local;
+    memset(&local, 0, sizeof(local));
+    int end = 0;
+    int fields = sscanf(text, "%d-%d-%d%n %d:%d:%d%n", &local.tm_year, &local.tm_mon, &local.tm_mday, &end,
+                        &local.tm_hour, &local.tm_min, &local.tm_sec, &end);
+    if ((fields != 3 && fields != 6) || text[end] != '\0' || local.tm_year < 1970 || local.tm_mon < 1 || local.tm_mon > 12
+        || local.tm_mday < 1 || local.tm_mday > 31 || local.tm_hour > 23 || local.tm_min > 59 || local.tm_sec > 60) {
+        return false;
+    }
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1;
+    time_t parsed = mktime(&local);
+    if (parsed <= 0) return false;
+    *timestamp = parsed;
+    return true;
+}
+
+static void write_date(FILE *file, int64_t timestamp) {
+    if (timestamp <= 0) return;
+    time_t t = (time_t)timestamp;
+    struct tm local;
+    char text[32];
+    if (localtime_r(&t, &local) != NULL && strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local) > 0) {
+        fputs(text, file);
+    }
+}
+
+// Control numbers and names end up in '|'-separated records, so they may not contain one.
+bool valid_text_field(const char* text, size_t max_length) {
+    return text[0] != '\0' && strlen(text) < max_length && strchr(text, '|') == NULL;
+}
+
+int run_import(const char* path) {
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (input == NULL) {
+        fprintf(stderr, "No se pudo abrir %s.\n", path);
+        return 1;
+    }
+    if (!load_data()) {
+        fprintf(stderr, "No se pudo leer %s: archivo danado o de otra version.\n", DATA_FILE);
+        if (input != stdin) fclose(input);
+        return 1;
+    }
+
+    journal.batching = true;
+    store_lock(); // released between batches, so kiosks only wait for one batch at a time
+    char line[IMPORT_MAX_LINE];
+    long line_number = 0;
+    long new_users = 0, new_donations = 0, duplicates = 0, rejected = 0;
+    int pending = 0;
+
+    while (fgets(line, sizeof(line), input)) {
+        line_number++;
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n' && !feof(input)) {
+            // skip the rest of an overlong line without buffering it
+            int c;
+            while ((c = fgetc(input)) != EOF && c != '\n') {}
+            fprintf(stderr, "%s:%ld: linea demasiado larga\n", path, line_number);
+            rejected++;
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') continue;
+        if (line_number == 1 && strncmp(line, "numero_control", 14) == 0) continue; // header
+
+        char *fields[CSV_FIELDS + 1];
+        int count = split_csv_line(line, fields, CSV_FIELDS);
+        if ((count < CSV_REQUIRED_FIELDS || count > CSV_FIELDS) && count != 2) {
+            fprintf(stderr, "%s:%ld: se esperaban de %d a %d campos\n", path, line_number, CSV_REQUIRED_FIELDS, CSV_FIELDS);
+            rejected++;
+            continue;
+        }
+        // an empty name is a donor registered without one (see add_donation), as exported
+        if (!valid_text_field(fields[0], MAX_CONTROL_NUMBER_LENGTH)
+            || (fields[1][0] != '\0' && !valid_text_field(fields[1], MAX_NAME_LENGTH))) {
+            fprintf(stderr, "%s:%ld: numero de control o nombre invalido\n", path, line_number);
+            rejected++;
+            continue;
+        }
+
+        bool registration = count == 2 || (fields[2][0] == '\0' && fields[3][0] == '\0' && fields[4][0] == '\0'
+                                           && (count == CSV_REQUIRED_FIELDS || fields[5][0] == '\0'));
+        int paper = 0, plastic = 0, aluminum = 0;
+        if (!registration && (!parse_quantity(fields[2], &paper) || !parse_quantity(fields[3], &plastic)
+                              || !parse_quantity(fields[4], &aluminum))) {
+            fprintf(stderr, "%s:%ld: cantidad invalida\n", path, line_number);
+            rejected++;
+            continue;
+        }
+        int64_t timestamp = time(NULL);
+        if (!registration && count > CSV_REQUIRED_FIELDS && !parse_date(fields[5], &timestamp)) {
+            fprintf(stderr, "%s:%ld: fecha invalida\n", path, line_number);
+            rejected++;
+            continue;
+        }
+        int center = shards.home;
+        if (count == CSV_FIELDS && fields[6][0] != '\0' && (!parse_quantity(fields[6], &center) || center >= MAX_CENTERS)) {
+            fprintf(stderr, "%s:%ld: centro invalido\n", path, line_number);
+            rejected++;
+            continue;
+        }
+
+        // dedupe by control number: the first registration wins
+        if (find_user(fields[0]) == NULL) {
+            User *user = add_user_at(fields[0], fields[1], center);
+            if (user == NULL) break;
+            journal_append_user(user);
+            new_users++;
+            pending++;
+        } else if (registration) {
+            duplicates++;
+        }
+
+        if (!registration) {
+            Donation *donation = add_donation(fields[0], paper, plastic, aluminum, timestamp);
+            if (donation == NULL) break;
+            journal_append_donation(donation);
+            new_donations++;
+            pending++;
+        }
+
+        if (pending >= IMPORT_BATCH_ROWS) {
+            journal_sync(); // rows so far are durable even if the import dies later
+            store_unlock();
+            store_lock();
+            pending = 0;
+        }
+    }
+    bool read_error = ferror(input);
+    if (input != stdin) fclose(input);
+
+    // fold the whole batch into the snapshot once instead of every JOURNAL_CHECKPOINT_RECORDS
+    journal.batching = false;
+    journal_sync();
+    if (journal.records > 0) save_data();
+    store_unlock();
+    journal_close();
+    free_store();
+
+    printf("%ld usuarios nuevos, %ld donaciones, %ld duplicados, %ld filas rechazadas\n",
+           new_users, new_donations, duplicates, rejected);
+    if (read_error) {
+        fprintf(stderr, "Error de lectura en %s.\n", path);
+        return 1;
+    }
+    return rejected > 0 ? 3 : 0;
+}
+
+// Quotes a field only when it needs it.
+static void write_csv_field(FILE *file, const char* text) {
+    if (strpbrk(text, ",\"") == NULL) {
+        fputs(text, file);
+        return;
+    }
+    fputc('"', file);
+    for (const char *c = text; *c; c++) {
+        if (*c == '"') fputc('"', file);
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+// Exports every user as a registration row with their center, then every donation, so that
+// importing the file into an empty database reproduces it exactly.
+int run_export(const char* path) {
+    if (!load_data()) {
+        fprintf(stderr, "No se pudo leer %s: archivo danado o de otra version.\n", DATA_FILE);
+        return 1;
+    }
+    FILE *output = path == NULL || strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (output == NULL) {
+        fprintf(stderr, "No se pudo escribir %s.\n", path);
+        journal_close();
+        free_store();
+        return 1;
+    }
+
+    fputs("numero_control,nombre,papel,plastico,aluminio,fecha,centro\n", output);
+    for (int i = 0; i < users.count; i++) {
+        const User *user = user_at(i);
+        write_csv_field(output, user->control_number);
+        fputc(',', output);
+        write_csv_field(output, user->name);
+        fprintf(output, ",,,,,%d\n", user->center);
+    }
+    for (int i = 0; i < donations.count; i++) {
+        const Donation *donation = donation_at(i);
+        const User *user = user_at(donation->user);
+        write_csv_field(output, user->control_number);
+        fputc(',', output);
+        write_csv_field(output, user->name);
+        fprintf(output, ",%d,%d,%d,", donation->paper, donation->plastic, donation->aluminum);
+        write_date(output, donation->timestamp);
+        fprintf(output, ",%d\n", user->center);
+    }
+
+    bool written = fflush(output) == 0 && !ferror(output);
+    if (output != stdout) written = fclose(output) == 0 && written;
+    journal_close();
+    free_store();
+    if (!written) {
+        fprintf(stderr, "Error al escribir la exportacion.\n");
+        return 1;
+    }
+    return 0;
+}
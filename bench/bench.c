@@ -0,0 +1,430 @@
+/*
+ * File:        bench.c
+ * Project:     Crucible
+ * Description: Microbenchmarks for the data layer (libcrucible): load, save, user
+ *              lookup and search, donation insert, aggregation, date ranges and cold
+ *              block decoding, in ns/op and allocations/op.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ *
+ * Usage:       bench/bench [-u usuarios] [-d donaciones] [-r repeticiones] [-s semilla]
+ *
+ * Every run builds the same synthetic store for a given seed, so numbers from two builds
+ * can be compared directly. Files are written to a private temporary directory. The cold
+ * tier codec is also round-tripped on edge cases; a mismatch makes the run exit with 1.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crucible.h"
+#include "synth.h"
+
+// --- Allocation counting ---
+// Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc (see the Makefile), so every
+// allocation the data layer makes comes through here first.
+static uint64_t alloc_calls = 0;
+static uint64_t alloc_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    alloc_calls++;
+    alloc_bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+// --- Timing ---
+typedef struct {
+    uint64_t start_ns;
+    uint64_t start_calls;
+    uint64_t start_bytes;
+} Measure;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void measure_start(Measure *m) {
+    m->start_calls = alloc_calls;
+    m->start_bytes = alloc_bytes;
+    m->start_ns = now_ns();
+}
+
+// Prints one result line; ops is how many operations the measured span covered.
+static void measure_report(const Measure *m, const char *name, uint64_t ops) {
+    uint64_t elapsed = now_ns() - m->start_ns;
+    if (ops == 0) ops = 1;
+    printf("%-22s %12llu %12.1f %10.4f %12.1f %10.2f\n", name, (unsigned long long)ops,
+           (double)elapsed / ops, (double)(alloc_calls - m->start_calls) / ops,
+           (double)(alloc_bytes - m->start_bytes) / ops, elapsed / 1e6);
+}
+
+// --- Fixtures ---
+static int opt_users = 100000;
+static int opt_donations = 500000;
+static int opt_repeat = 5;
+static uint64_t opt_seed = 1;
+
+static char work_dir[] = "/tmp/crucible-bench-XXXXXX";
+static char text_path[PATH_MAX];
+static char binary_path[PATH_MAX];
+static char journal_path[PATH_MAX];
+static char shared_path[PATH_MAX];
+
+// Back to an empty store, as if the process had just started.
+static void reset_store() {
+    journal_close();
+    free_store();
+    memset(&journal, 0, sizeof(journal));
+    data_format = FORMAT_BINARY;
+}
+
+static void populate(int user_count, int donation_count, uint64_t seed) {
+    SynthRng rng;
+    synth_seed(&rng, seed);
+    char control_number[MAX_CONTROL_NUMBER_LENGTH];
+    char name[MAX_NAME_LENGTH];
+    for (int i = 0; i < user_count; i++) {
+        synth_control_number(i, control_number, sizeof(control_number));
+        synth_name(&rng, name, sizeof(name));
+        add_user(control_number, name);
+    }
+    for (int i = 0; i < donation_count; i++) {
+        synth_control_number(synth_donor(&rng, user_count), control_number, sizeof(control_number));
+        int paper = synth_kg(&rng);
+        int plastic = synth_kg(&rng);
+        int aluminum = synth_kg(&rng);
+        int64_t timestamp = synth_timestamp(&rng, i, donation_count);
+        add_donation(control_number, paper, plastic, aluminum, timestamp);
+    }
+}
+
+// --- Benchmarks ---
+static void bench_save(const char *name, const char *path, DataFormat format) {
+    Measure m;
+    measure_start(&m);
+    for (int r = 0; r < opt_repeat; r++) {
+        if (!write_snapshot(path, format, 0)) {
+            fprintf(stderr, "No se pudo escribir %s.\n", path);
+            exit(1);
+        }
+    }
+    measure_report(&m, name, (uint64_t)opt_repeat * (users.count + donations.count));
+}
+
+// Full startup path: snapshot, journal replay and aggregate build. Reported per record.
+static void bench_load(const char *name, const char *path) {
+    uint64_t total_ns = 0, calls = 0, bytes = 0, records = 0;
+    for (int r = 0; r < opt_repeat; r++) {
+        reset_store();
+        remove(journal_path);
+        DATA_FILE = path;
+        Measure m;
+        measure_start(&m);
+        if (!load_data()) {
+            fprintf(stderr, "No se pudo leer %s.\n", path);
+            exit(1);
+        }
+        total_ns += now_ns() - m.start_ns;
+        calls += alloc_calls - m.start_calls;
+        bytes += alloc_bytes - m.start_bytes;
+        records += users.count + donations.count;
+    }
+    printf("%-22s %12llu %12.1f %10.4f %12.1f %10.2f\n", name, (unsigned long long)records,
+           (double)total_ns / records, (double)calls / records, (double)bytes / records, total_ns / 1e6);
+}
+
+static void bench_lookup() {
+    SynthRng rng;
+    synth_seed(&rng, opt_seed + 1);
+    char control_number[MAX_CONTROL_NUMBER_LENGTH];
+    int ops = 1000000;
+    int found = 0;
+
+    Measure m;
+    measure_start(&m);
+    for (int i = 0; i < ops; i++) {
+        synth_control_number((int)synth_below(&rng, (uint32_t)opt_users), control_number, sizeof(control_number));
+        found += find_user(control_number) != NULL;
+    }
+    measure_report(&m, "lookup_hit", ops);
+
+    measure_start(&m);
+    for (int i = 0; i < ops; i++) {
+        synth_control_number(opt_users + (int)synth_below(&rng, (uint32_t)opt_users), control_number, sizeof(control_number));
+        found += find_user(control_number) != NULL;
+    }
+    measure_report(&m, "lookup_miss", ops);
+    if (found != ops) fprintf(stderr, "lookup: %d de %d encontrados\n", found, ops);
+}
+
+// As-you-type search: every query is a keystroke, a name or control number prefix of 1-6 bytes.
+static void bench_search() {
+    Measure m;
+    measure_start(&m);
+    if (!search_enable()) {
+        fprintf(stderr, "search: sin memoria para el indice\n");
+        return;
+    }
+    measure_report(&m, "search_build", users.count);
+
+    SynthRng rng;
+    synth_seed(&rng, opt_seed + 3);
+    static SearchResult result;
+    char text[MAX_NAME_LENGTH];
+    int ops = 200000;
+    uint64_t matches = 0;
+    measure_start(&m);
+    for (int i = 0; i < ops; i++) {
+        if (i & 1) {
+            synth_name(&rng, text, sizeof(text));
+        } else {
+            synth_control_number((int)synth_below(&rng, (uint32_t)opt_users), text, sizeof(text));
+        }
+        text[1 + synth_below(&rng, 6)] = '\0';
+        search_users(text, &result);
+        matches += result.total;
+    }
+    measure_report(&m, "search_prefix", ops);
+    if (matches == 0) fprintf(stderr, "search: ninguna busqueda encontro usuarios\n");
+}
+
+// Inserts with the aggregates and columns live, as in the running kiosk.
+static void bench_insert() {
+    SynthRng rng;
+    synth_seed(&rng, opt_seed + 2);
+    char control_number[MAX_CONTROL_NUMBER_LENGTH];
+    int ops = 1000000;
+
+    Measure m;
+    measure_start(&m);
+    for (int i = 0; i < ops; i++) {
+        synth_control_number(synth_donor(&rng, opt_users), control_number, sizeof(control_number));
+        int paper = synth_kg(&rng);
+        int plastic = synth_kg(&rng);
+        int aluminum = synth_kg(&rng);
+        add_donation(control_number, paper, plastic, aluminum, SYNTH_EPOCH_END + i); // newest, like the kiosk
+    }
+    measure_report(&m, "donation_insert", ops);
+}
+
+static void bench_aggregation() {
+    Measure m;
+    measure_start(&m);
+    for (int r = 0; r < opt_repeat; r++) {
+        free_aggregates();
+        build_aggregates();
+    }
+    measure_report(&m, "aggregate_build", (uint64_t)opt_repeat * donations.count);
+
+    int top[LEADERBOARD_MAX];
+    int ops = 100000;
+    measure_start(&m);
+    for (int i = 0; i < ops; i++) {
+        top_donors((Material)(i % MATERIAL_COUNT), 10, top);
+    }
+    measure_report(&m, "top_donors_10", ops);
+
+    if (!columns_enable()) return;
+    const ColumnKernels *kernels = column_kernels();
+    int64_t total = 0;
+    measure_start(&m);
+    for (int r = 0; r < opt_repeat; r++) {
+        for (int mat = 0; mat < MATERIAL_COUNT; mat++) {
+            total += kernels->sum(material_column((Material)mat), (size_t)columns.count);
+        }
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "column_sum_%s", kernels->name);
+    measure_report(&m, name, (uint64_t)opt_repeat * MATERIAL_COUNT * columns.count);
+    if (total != (int64_t)opt_repeat * (aggregates.global.kg[0] + aggregates.global.kg[1] + aggregates.global.kg[2])) {
+        fprintf(stderr, "column_sum: el total no coincide con los agregados\n");
+    }
+
+    // date ranges with arbitrary edges: rollups for the whole days, the index for the rest
+    SynthRng rng;
+    synth_seed(&rng, opt_seed + 4);
+    RollupBucket bucket;
+    int64_t counted = 0;
+    ops = 100000;
+    measure_start(&m);
+    for (int i = 0; i < ops; i++) {
+        int64_t from = SYNTH_EPOCH_END - SYNTH_SPAN + (int64_t)synth_below(&rng, (uint32_t)SYNTH_SPAN);
+        int64_t length = (int64_t)synth_below(&rng, 90 * 86400);
+        timeline_range(from, from + length, &bucket);
+        counted += bucket.count;
+    }
+    measure_report(&m, "date_range_90d", ops);
+
+    timeline_range(0, SYNTH_EPOCH_END + 86400, &bucket);
+    if (bucket.count + aggregates.timeline.undated.count != donations.count) {
+        fprintf(stderr, "date_range: %d de %d donaciones en el rango completo\n", bucket.count, donations.count);
+    }
+    if (counted == 0) fprintf(stderr, "date_range: ningun rango encontro donaciones\n");
+}
+
+// --- Cold tier codec ---
+// Encodes the records as one cold block and decodes them back; any record or summary field
+// that doesn't survive is reported and fails the run.
+static bool codec_round_trip(const char *name, const Donation *records, int count, uint8_t *encoded, Donation *decoded) {
+    ColdBlock block;
+    size_t length = cold_encode(records, count, encoded, &block);
+    cold_decode(encoded, &block, decoded);
+    if (length != block.bytes || block.count != (uint32_t)count) {
+        fprintf(stderr, "cold_codec %s: tamano incorrecto\n", name);
+        return false;
+    }
+    bool same = true;
+    for (int i = 0; i < count && same; i++) {
+        const Donation *a = &records[i], *b = &decoded[i];
+        same = a->user == b->user && a->paper == b->paper && a->plastic == b->plastic
+            && a->aluminum == b->aluminum && a->timestamp == b->timestamp;
+        if (!same) fprintf(stderr, "cold_codec %s: el registro %d no coincide\n", name, i);
+    }
+    for (int m = 0; m < MATERIAL_COUNT && same; m++) {
+        int64_t sum = 0;
+        int32_t min = INT32_MAX, max = INT32_MIN;
+        for (int i = 0; i < count; i++) {
+            int32_t kg = m == MATERIAL_PAPER ? records[i].paper : m == MATERIAL_PLASTIC ? records[i].plastic : records[i].aluminum;
+            sum += kg;
+            if (kg < min) min = kg;
+            if (kg > max) max = kg;
+        }
+        same = block.sum[m] == sum && block.min[m] == min && block.max[m] == max;
+        if (!same) fprintf(stderr, "cold_codec %s: el resumen no coincide\n", name);
+    }
+    return same;
+}
+
+// Round trips the cases the encoder's deltas have to get right, then times decoding a full
+// block. Returns false if any case came back different.
+static bool bench_cold_codec() {
+    Donation *records = malloc(COLD_BLOCK_RECORDS * sizeof(Donation));
+    Donation *decoded = malloc(COLD_BLOCK_RECORDS * sizeof(Donation));
+    uint8_t *encoded = malloc(COLD_BLOCK_RECORDS * 48);
+    if (records == NULL || decoded == NULL || encoded == NULL) {
+        free(records);
+        free(decoded);
+        free(encoded);
+        return false;
+    }
+    bool passed = true;
+
+    records[0] = (Donation){ 7, 3, 0, 1, SYNTH_EPOCH_END };
+    passed &= codec_round_trip("un_registro", records, 1, encoded, decoded);
+
+    // undated donations (0) among dated ones: the timestamp deltas jump both ways
+    for (int i = 0; i < 16; i++) {
+        records[i] = (Donation){ (uint32_t)(i % 3), i, 2 * i, 0, i % 2 == 0 ? 0 : SYNTH_EPOCH_END - i * 3600 };
+    }
+    passed &= codec_round_trip("sin_fecha", records, 16, encoded, decoded);
+
+    // every delta negative, and the widest jumps a quantity can make
+    for (int i = 0; i < 64; i++) {
+        int32_t wide = i % 2 == 0 ? INT32_MAX : 0;
+        records[i] = (Donation){ (uint32_t)(1000000 - i * 997), wide, INT32_MAX - wide, 64 - i, SYNTH_EPOCH_END - i * 86400 };
+    }
+    passed &= codec_round_trip("deltas_negativos", records, 64, encoded, decoded);
+
+    SynthRng rng;
+    synth_seed(&rng, opt_seed + 5);
+    for (int i = 0; i < COLD_BLOCK_RECORDS; i++) {
+        int64_t timestamp = synth_below(&rng, 8) == 0 ? 0 : synth_timestamp(&rng, i, COLD_BLOCK_RECORDS);
+        records[i] = (Donation){ synth_below(&rng, 1u << 31), synth_kg(&rng), synth_kg(&rng), synth_kg(&rng), timestamp };
+    }
+    passed &= codec_round_trip("bloque_lleno", records, COLD_BLOCK_RECORDS, encoded, decoded);
+
+    ColdBlock block;
+    cold_encode(records, COLD_BLOCK_RECORDS, encoded, &block);
+    int blocks = opt_repeat * 1000;
+    Measure m;
+    measure_start(&m);
+    for (int r = 0; r < blocks; r++) cold_decode(encoded, &block, decoded);
+    measure_report(&m, "cold_decode", (uint64_t)blocks * COLD_BLOCK_RECORDS);
+
+    free(records);
+    free(decoded);
+    free(encoded);
+    return passed;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-u usuarios] [-d donaciones] [-r repeticiones] [-s semilla]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "u:d:r:s:")) != -1) {
+        switch (opt) {
+            case 'u': opt_users = atoi(optarg); break;
+            case 'd': opt_donations = atoi(optarg); break;
+            case 'r': opt_repeat = atoi(optarg); break;
+            case 's': opt_seed = strtoull(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (opt_users <= 0 || opt_donations < 0 || opt_repeat <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (mkdtemp(work_dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(text_path, sizeof(text_path), "%s/data.txt", work_dir);
+    snprintf(binary_path, sizeof(binary_path), "%s/data.dat", work_dir);
+    snprintf(journal_path, sizeof(journal_path), "%s/data.journal", work_dir);
+    snprintf(shared_path, sizeof(shared_path), "%s/data.shm", work_dir);
+    DATA_FILE = binary_path;
+    JOURNAL_FILE = journal_path;
+    SHARED_FILE = shared_path;
+
+    printf("usuarios=%d donaciones=%d repeticiones=%d semilla=%llu\n\n", opt_users, opt_donations,
+           opt_repeat, (unsigned long long)opt_seed);
+    printf("%-22s %12s %12s %10s %12s %10s\n", "benchmark", "ops", "ns/op", "allocs/op", "bytes/op", "total ms");
+
+    populate(opt_users, opt_donations, opt_seed);
+    bench_save("save_text", text_path, FORMAT_TEXT);
+    bench_save("save_binary", binary_path, FORMAT_BINARY);
+    bench_load("load_text", text_path);
+    bench_load("load_binary", binary_path);
+
+    // the remaining benchmarks run on a store loaded the way the kiosk loads it
+    reset_store();
+    DATA_FILE = text_path;
+    load_data();
+    bench_lookup();
+    bench_search();
+    bench_aggregation();
+    bench_insert();
+    bool codec_ok = bench_cold_codec();
+
+    reset_store();
+    remove(text_path);
+    remove(binary_path);
+    remove(journal_path);
+    remove(shared_path);
+    rmdir(work_dir);
+    return codec_ok ? 0 : 1;
+}
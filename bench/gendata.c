@@ -0,0 +1,61 @@
+/*
+ * File:        gendata.c
+ * Project:     Crucible
+ * Description: Writes a synthetic database (text snapshot format) with N users and
+ *              M donations, e.g. to try the UI or --convert on a kiosk-sized store.
+ *              With a number of centers the users are spread over them (R records).
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ *
+ * Usage:       bench/gendata <usuarios> <donaciones> [semilla [centros]] > recycling_data.txt
+ */
+
+#include <stdlib.h>
+
+#include "synth.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Uso: %s <usuarios> <donaciones> [semilla [centros]]\n", argv[0]);
+        return 2;
+    }
+    int user_count = atoi(argv[1]);
+    long donation_count = atol(argv[2]);
+    uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+    int centers = argc > 4 ? atoi(argv[4]) : 0;
+    if (user_count <= 0 || donation_count < 0) {
+        fprintf(stderr, "Se necesita al menos un usuario.\n");
+        return 2;
+    }
+    if (centers < 0 || centers > 255) {
+        fprintf(stderr, "Los centros van de 0 a 255.\n");
+        return 2;
+    }
+
+    SynthRng rng;
+    synth_seed(&rng, seed);
+    char control_number[32];
+    char name[64];
+
+    printf("C|0\n");
+    for (int i = 0; i < user_count; i++) {
+        synth_control_number(i, control_number, sizeof(control_number));
+        synth_name(&rng, name, sizeof(name));
+        int center = synth_center(i, centers);
+        if (center == 0) {
+            printf("U|%s|%s\n", control_number, name);
+        } else {
+            printf("R|%d|%s|%s\n", center, control_number, name);
+        }
+    }
+    for (long i = 0; i < donation_count; i++) {
+        synth_control_number(synth_donor(&rng, user_count), control_number, sizeof(control_number));
+        int paper = synth_kg(&rng);
+        int plastic = synth_kg(&rng);
+        int aluminum = synth_kg(&rng);
+        long long timestamp = synth_timestamp(&rng, i, donation_count);
+        printf("D|%s|%d|%d|%d|%lld\n", control_number, paper, plastic, aluminum, timestamp);
+    }
+    return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * File:        loadgen.c
+ * Project:     Crucible
+ * Description: Load generator for the socket server (./main serve): many local clients
+ *              registering a user each and then pipelining donations, reporting sustained
+ *              inserts per second and the latency distribution of the answers.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ *
+ * Usage:       bench/loadgen [-s socket] [-c clientes] [-p profundidad] [-t segundos]
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Latency is measured from when a request is queued to when its answer line is read, so a
+// request waiting behind the pipeline counts the wait.
+
+typedef struct {
+    int fd;
+    char control_number[24];
+    uint64_t *sent_at;   // ring of in-flight requests, oldest first
+    int head;
+    int in_flight;
+    long requests;
+    char in[4096];
+    size_t in_length;
+    char out[8192];
+    size_t out_length;
+} Connection;
+
+static int opt_clients = 200;
+static int opt_depth = 8;
+static double opt_seconds = 5.0;
+static const char *opt_socket = "recycling_data.dat.sock";
+
+static uint64_t *latencies;
+static size_t latency_count, latency_capacity;
+static long answered_ok, answered_error;
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void record_latency(uint64_t latency) {
+    if (latency_count == latency_capacity) {
+        latency_capacity = latency_capacity > 0 ? latency_capacity * 2 : 1 << 16;
+        latencies = realloc(latencies, latency_capacity * sizeof(uint64_t));
+        if (latencies == NULL) {
+            fprintf(stderr, "Sin memoria para las latencias.\n");
+            exit(1);
+        }
+    }
+    latencies[latency_count++] = latency;
+}
+
+// Queues requests until depth are in flight: the registration first, then donations.
+static void fill(Connection *connection) {
+    while (connection->in_flight < opt_depth && connection->out_length + 64 < sizeof(connection->out)) {
+        char *out = connection->out + connection->out_length;
+        size_t room = sizeof(connection->out) - connection->out_length;
+        int length;
+        if (connection->requests == 0) {
+            length = snprintf(out, room, "U|%s|Cliente de carga\n", connection->control_number);
+        } else {
+            long n = connection->requests;
+            length = snprintf(out, room, "D|%s|%ld|%ld|%ld\n", connection->control_number, n % 7, n % 5, n % 3);
+        }
+        connection->out_length += (size_t)length;
+        int slot = (connection->head + connection->in_flight) % opt_depth;
+        connection->sent_at[slot] = now_ns();
+        connection->in_flight++;
+        connection->requests++;
+    }
+}
+
+static bool flush(Connection *connection) {
+    size_t sent = 0;
+    while (sent < connection->out_length) {
+        ssize_t written = send(connection->fd, connection->out + sent, connection->out_length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (written <= 0) return false;
+        sent += (size_t)written;
+    }
+    memmove(connection->out, connection->out + sent, connection->out_length - sent);
+    connection->out_length -= sent;
+    return true;
+}
+
+// Reads answers and matches them, in order, with the oldest requests in flight.
+static bool receive(Connection *connection) {
+    ssize_t received = read(connection->fd, connection->in + connection->in_length,
+                            sizeof(connection->in) - connection->in_length);
+    if (received < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    if (received == 0) return false;
+    connection->in_length += (size_t)received;
+
+    uint64_t now = now_ns();
+    char *line = connection->in;
+    char *end = connection->in + connection->in_length;
+    char *newline;
+    while ((newline = memchr(line, '\n', (size_t)(end - line))) != NULL) {
+        if (connection->in_flight == 0) return false; // an answer we never asked for
+        record_latency(now - connection->sent_at[connection->head]);
+        connection->head = (connection->head + 1) % opt_depth;
+        connection->in_flight--;
+        if (strncmp(line, "OK", 2) == 0) {
+            answered_ok++;
+        } else {
+            if (answered_error == 0) fprintf(stderr, "primer error: %.*s\n", (int)(newline - line), line);
+            answered_error++;
+        }
+        line = newline + 1;
+    }
+    connection->in_length = (size_t)(end - line);
+    memmove(connection->in, line, connection->in_length);
+    return true;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(double q) {
+    if (latency_count == 0) return 0;
+    double exact = q * (double)latency_count; // nearest rank
+    size_t rank = (size_t)exact;
+    if (rank < exact || rank == 0) rank++;
+    return (double)latencies[rank - 1] / 1e6;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-s socket] [-c clientes] [-p profundidad] [-t segundos]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "s:c:p:t:")) != -1) {
+        switch (option) {
+            case 's': opt_socket = optarg; break;
+            case 'c': opt_clients = atoi(optarg); break;
+            case 'p': opt_depth = atoi(optarg); break;
+            case 't': opt_seconds = atof(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (opt_clients <= 0 || opt_depth <= 0 || opt_seconds <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(opt_socket) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Ruta de socket demasiado larga: %s\n", opt_socket);
+        return 2;
+    }
+    strcpy(address.sun_path, opt_socket);
+
+    int epoll_fd = epoll_create1(0);
+    Connection *connections = calloc((size_t)opt_clients, sizeof(Connection));
+    if (epoll_fd < 0 || connections == NULL) {
+        fprintf(stderr, "Sin memoria.\n");
+        return 1;
+    }
+    int run = (int)(getpid() % 100000);
+    for (int i = 0; i < opt_clients; i++) {
+        Connection *connection = &connections[i];
+        connection->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        connection->sent_at = calloc((size_t)opt_depth, sizeof(uint64_t));
+        if (connection->fd < 0 || connection->sent_at == NULL
+            || connect(connection->fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            fprintf(stderr, "No se pudo conectar a %s (cliente %d).\n", opt_socket, i);
+            return 1;
+        }
+        snprintf(connection->control_number, sizeof(connection->control_number), "lg%05d-%d", run, i);
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection->fd, &event);
+    }
+
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)(opt_seconds * 1e9);
+    uint64_t drain_deadline = deadline + 10000000000ull;
+    for (int i = 0; i < opt_clients; i++) {
+        fill(&connections[i]);
+        flush(&connections[i]);
+    }
+
+    struct epoll_event events[256];
+    long in_flight = 1;
+    bool failed = false;
+    while (in_flight > 0 && !failed) {
+        uint64_t now = now_ns();
+        if (now > drain_deadline) {
+            fprintf(stderr, "El servidor no contesto %ld solicitudes.\n", in_flight);
+            failed = true;
+            break;
+        }
+        int ready = epoll_wait(epoll_fd, events, 256, 100);
+        bool generating = now_ns() < deadline;
+        for (int i = 0; i < ready; i++) {
+            Connection *connection = &connections[events[i].data.u32];
+            if (!receive(connection)) {
+                fprintf(stderr, "El servidor cerro la conexion.\n");
+                failed = true;
+                break;
+            }
+            if (generating) fill(connection);
+            if (!flush(connection)) {
+                failed = true;
+                break;
+            }
+        }
+        in_flight = 0;
+        for (int i = 0; i < opt_clients; i++) {
+            in_flight += connections[i].in_flight;
+            if (connections[i].out_length > 0) flush(&connections[i]); // the rare partial send
+        }
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    qsort(latencies, latency_count, sizeof(uint64_t), compare_latency);
+    printf("clientes=%d profundidad=%d segundos=%.1f\n\n", opt_clients, opt_depth, elapsed);
+    printf("%12s %12s %10s %10s %10s %10s %10s\n", "ok", "ok/s", "errores", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+    printf("%12ld %12.0f %10ld %10.3f %10.3f %10.3f %10.3f\n", answered_ok, (double)answered_ok / elapsed,
+           answered_error, percentile_ms(0.50), percentile_ms(0.99), percentile_ms(0.999),
+           latency_count > 0 ? (double)latencies[latency_count - 1] / 1e6 : 0.0);
+
+    for (int i = 0; i < opt_clients; i++) {
+        close(connections[i].fd);
+        free(connections[i].sent_at);
+    }
+    free(connections);
+    free(latencies);
+    close(epoll_fd);
+    return failed || answered_error > 0 ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * File:        synth.h
+ * Project:     Crucible
+ * Description: Deterministic synthetic users and donations, shared by the data
+ *              generator and the benchmarks so both see the same distribution.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#ifndef CRUCIBLE_SYNTH_H
+#define CRUCIBLE_SYNTH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// xorshift64*: tiny, fast and the same on every machine for a given seed
+typedef struct {
+    uint64_t state;
+} SynthRng;
+
+static inline void synth_seed(SynthRng *rng, uint64_t seed) {
+    rng->state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint64_t synth_next(SynthRng *rng) {
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545F4914F6CDD1Dull;
+}
+
+static inline uint32_t synth_below(SynthRng *rng, uint32_t n) {
+    return (uint32_t)((synth_next(rng) >> 32) * n >> 32);
+}
+
+// Control numbers look like the school ones: 8 digits, unique per user position.
+static inline void synth_control_number(int user, char *out, size_t size) {
+    snprintf(out, size, "%08d", 20000000 + user);
+}
+
+static inline void synth_name(SynthRng *rng, char *out, size_t size) {
+    static const char *first[] = { "Ana", "Luis", "Maria", "Jose", "Sofia", "Diego", "Lucia", "Jorge",
+                                   "Valeria", "Carlos", "Fernanda", "Miguel", "Paola", "Raul", "Andrea", "Ivan" };
+    static const char *last[] = { "Garcia", "Lopez", "Hernandez", "Martinez", "Gonzalez", "Perez", "Ramirez", "Torres",
+                                  "Flores", "Rivera", "Gomez", "Diaz", "Cruz", "Morales", "Reyes", "Ortiz" };
+    snprintf(out, size, "%s %s %s", first[synth_below(rng, 16)], last[synth_below(rng, 16)], last[synth_below(rng, 16)]);
+}
+
+// Users spread round-robin over centers 1..centers; 0 centers leaves everyone without one.
+static inline int synth_center(int user, int centers) {
+    return centers > 0 ? 1 + user % centers : 0;
+}
+
+// Donors are skewed like the real data: a few regulars bring most of the material.
+static inline int synth_donor(SynthRng *rng, int user_count) {
+    uint32_t r = synth_below(rng, 1u << 16);
+    return (int)(((uint64_t)r * r * (uint32_t)user_count) >> 32);
+}
+
+static inline int synth_kg(SynthRng *rng) {
+    return synth_below(rng, 4) == 0 ? 0 : (int)synth_below(rng, 40) + 1;
+}
+
+// Donation i of count, spread evenly over the year before SYNTH_EPOCH_END (2025-01-01 UTC)
+// in insert order, with a little jitter so a few arrive out of order like late kiosk clocks.
+#define SYNTH_EPOCH_END 1735689600ll
+#define SYNTH_SPAN (365ll * 86400)
+
+static inline int64_t synth_timestamp(SynthRng *rng, int64_t i, int64_t count) {
+    return SYNTH_EPOCH_END - SYNTH_SPAN + i * SYNTH_SPAN / (count > 0 ? count : 1) + synth_below(rng, 600);
+}
+
+#endif
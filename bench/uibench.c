@@ -0,0 +1,565 @@
+/*
+ * File:        uibench.c
+ * Project:     Crucible
+ * Description: End-to-end latency harness for the kiosk UI: runs ./main under a pseudo
+ *              terminal on a synthetic database and replays a scripted session (login,
+ *              donation, own donations, list views, the info submenu), measuring for every
+ *              keystroke the time until the screen settles and the bytes sent to the
+ *              terminal. The report can be saved and compared against another build's to
+ *              catch regressions.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ *
+ * Usage:       bench/uibench [-m main] [-a assets] [-u usuarios] [-d donaciones] [-s semilla]
+ *                            [-r repeticiones] [-f guion] [-g filasxcolumnas] [-q ms]
+ *                            [-o reporte.tsv] [-b base.tsv] [-x tolerancia%] [-t salida.tty]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <curses.h>
+#include <term.h>
+
+#include "synth.h"
+
+// A script is one step per line: a label, then the keys, each sent and timed on its own.
+// Keys are literal characters or <name> (<name>*N repeats it); the names map to the
+// terminal's own key sequences from terminfo, so arrows and paging work on any TERM. Steps
+// sharing a label are reported together. The screen has settled when nothing arrives for
+// the quiet window; a key's latency runs from the write to the last byte before that.
+static const char *default_script[] = {
+    "# menu principal: Iniciar Sesion",
+    "login       <enter>",
+    "login       20000001 <enter>",
+    "login       Ana<space>Garcia <enter>",
+    "login       <space>",
+    "# tras iniciar sesion el menu queda en Registrar Donacion",
+    "donacion    <enter>",
+    "donacion    5 <enter> 3 <enter> 2 <enter>",
+    "donacion    <space>",
+    "menu        <down>",
+    "mis         <enter>",
+    "mis         <pgdn> <end> <home>",
+    "mis         q",
+    "menu        <down>",
+    "usuarios    <enter>",
+    "usuarios    <pgdn>*5 <end> <pgup>*3 <home> <down>*10",
+    "usuarios    q",
+    "menu        <down>",
+    "buscar      <enter>",
+    "buscar      Garcia <bs>*6",
+    "buscar      <esc>",
+    "menu        <down>",
+    "donaciones  <enter>",
+    "donaciones  <pgdn>*5 <end> <pgup>*3 <home> <down>*10",
+    "donaciones  q",
+    "menu        <down>*4",
+    "info        <enter> <enter> <space>",
+    "info        <enter> <down> <enter> <space>",
+    "info        <enter> <down>*2 <enter> <space>",
+    "salida      q",
+};
+
+#define MAX_KEY_LENGTH 16
+
+typedef struct {
+    char name[24];
+    uint64_t *samples; // ns per keystroke, every repetition
+    size_t count, capacity;
+    uint64_t bytes;
+    long keys;         // keystrokes per repetition
+} Label;
+
+typedef struct {
+    int label;
+    char key[MAX_KEY_LENGTH];
+} Keystroke;
+
+static const char *opt_main = "./main";
+static const char *opt_assets = "assets";
+static int opt_users = 10000;
+static long opt_donations = 100000;
+static uint64_t opt_seed = 1;
+static int opt_runs = 5;
+static const char *opt_script = NULL;
+static int opt_rows = 40, opt_cols = 120;
+static int opt_quiet_ms = 50;
+static const char *opt_report = NULL;
+static const char *opt_baseline = NULL;
+static double opt_tolerance = 20.0;
+static const char *opt_transcript = NULL;
+static FILE *transcript; // raw terminal output of the last run, to check what a script does
+
+static Label *labels;
+static int label_count;
+static Keystroke *keystrokes;
+static int keystroke_count;
+
+static char work_dir[] = "/tmp/uibench.XXXXXX";
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void *grow(void *items, size_t count, size_t *capacity, size_t size) {
+    if (count < *capacity) return items;
+    *capacity = *capacity > 0 ? *capacity * 2 : 64;
+    items = realloc(items, *capacity * size);
+    if (items == NULL) {
+        fprintf(stderr, "Sin memoria.\n");
+        exit(1);
+    }
+    return items;
+}
+
+// --- Script ---
+
+static int label_find(const char *name) {
+    for (int i = 0; i < label_count; i++) {
+        if (strcmp(labels[i].name, name) == 0) return i;
+    }
+    static size_t capacity;
+    labels = grow(labels, (size_t)label_count, &capacity, sizeof(Label));
+    memset(&labels[label_count], 0, sizeof(Label));
+    snprintf(labels[label_count].name, sizeof(labels[label_count].name), "%s", name);
+    return label_count++;
+}
+
+static void keystroke_add(int label, const char *key) {
+    static size_t capacity;
+    keystrokes = grow(keystrokes, (size_t)keystroke_count, &capacity, sizeof(Keystroke));
+    keystrokes[keystroke_count].label = label;
+    snprintf(keystrokes[keystroke_count].key, MAX_KEY_LENGTH, "%s", key);
+    keystroke_count++;
+    labels[label].keys++;
+}
+
+// The bytes a named key sends on this terminal, or NULL for an unknown name.
+static const char *key_sequence(const char *name) {
+    static const struct { const char *name, *capability, *fixed; } keys[] = {
+        { "up", "kcuu1", NULL }, { "down", "kcud1", NULL }, { "left", "kcub1", NULL },
+        { "right", "kcuf1", NULL }, { "pgup", "kpp", NULL }, { "pgdn", "knp", NULL },
+        { "home", "khome", NULL }, { "end", "kend", NULL }, { "bs", "kbs", NULL },
+        { "enter", NULL, "\r" }, { "esc", NULL, "\033" }, { "space", NULL, " " }, { "tab", NULL, "\t" },
+    };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strcmp(keys[i].name, name) != 0) continue;
+        if (keys[i].fixed != NULL) return keys[i].fixed;
+        const char *sequence = tigetstr((char *)keys[i].capability);
+        return sequence == NULL || sequence == (char *)-1 ? NULL : sequence;
+    }
+    return NULL;
+}
+
+static bool parse_script_line(const char *text, int number) {
+    char line[512];
+    snprintf(line, sizeof(line), "%s", text);
+    line[strcspn(line, "\r\n")] = '\0';
+    char *save;
+    char *token = strtok_r(line, " \t", &save);
+    if (token == NULL || token[0] == '#') return true;
+    int label = label_find(token);
+
+    while ((token = strtok_r(NULL, " \t", &save)) != NULL) {
+        while (*token != '\0') {
+            if (*token != '<') {
+                char key[2] = { *token++, '\0' };
+                keystroke_add(label, key);
+                continue;
+            }
+            char *close = strchr(token, '>');
+            if (close == NULL) {
+                fprintf(stderr, "linea %d: falta '>' en %s\n", number, token);
+                return false;
+            }
+            *close = '\0';
+            const char *sequence = key_sequence(token + 1);
+            if (sequence == NULL || strlen(sequence) >= MAX_KEY_LENGTH) {
+                fprintf(stderr, "linea %d: tecla desconocida <%s>\n", number, token + 1);
+                return false;
+            }
+            token = close + 1;
+            int repeat = 1;
+            if (*token == '*') repeat = (int)strtol(token + 1, &token, 10);
+            for (int i = 0; i < repeat; i++) keystroke_add(label, sequence);
+        }
+    }
+    return true;
+}
+
+static bool load_script() {
+    if (opt_script == NULL) {
+        for (size_t i = 0; i < sizeof(default_script) / sizeof(default_script[0]); i++) {
+            if (!parse_script_line(default_script[i], (int)i + 1)) return false;
+        }
+        return true;
+    }
+    FILE *file = fopen(opt_script, "r");
+    if (file == NULL) {
+        fprintf(stderr, "No se pudo abrir %s\n", opt_script);
+        return false;
+    }
+    char line[512];
+    bool ok = true;
+    for (int number = 1; ok && fgets(line, sizeof(line), file) != NULL; number++) {
+        ok = parse_script_line(line, number);
+    }
+    fclose(file);
+    if (ok && keystroke_count == 0) {
+        fprintf(stderr, "%s no tiene pasos.\n", opt_script);
+        ok = false;
+    }
+    return ok;
+}
+
+// --- Database ---
+// Generated once as text and converted with the binary under test, then copied into place
+// before every run so each one starts from the same store.
+
+static bool write_text_database(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return false;
+    SynthRng rng;
+    synth_seed(&rng, opt_seed);
+    char control_number[32], name[64];
+    fprintf(file, "C|0\n");
+    for (int i = 0; i < opt_users; i++) {
+        synth_control_number(i, control_number, sizeof(control_number));
+        synth_name(&rng, name, sizeof(name));
+        fprintf(file, "U|%s|%s\n", control_number, name);
+    }
+    for (long i = 0; i < opt_donations; i++) {
+        synth_control_number(synth_donor(&rng, opt_users), control_number, sizeof(control_number));
+        int paper = synth_kg(&rng), plastic = synth_kg(&rng), aluminum = synth_kg(&rng);
+        fprintf(file, "D|%s|%d|%d|%d|%lld\n", control_number, paper, plastic, aluminum,
+                (long long)synth_timestamp(&rng, i, opt_donations));
+    }
+    return fclose(file) == 0;
+}
+
+static bool copy_file(const char *from, const char *to) {
+    int in = open(from, O_RDONLY);
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = in >= 0 && out >= 0;
+    char buffer[1 << 16];
+    ssize_t length;
+    while (ok && (length = read(in, buffer, sizeof(buffer))) > 0) {
+        ok = write(out, buffer, (size_t)length) == length;
+    }
+    if (in >= 0) close(in);
+    if (out >= 0 && close(out) != 0) ok = false;
+    return ok;
+}
+
+static void remove_store() {
+    static const char *files[] = { "recycling_data.dat", "recycling_data.dat.journal",
+                                   "recycling_data.dat.shm", "recycling_data.dat.journal.tmp" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) unlink(files[i]);
+}
+
+static bool prepare_work_dir(const char *main_path, const char *assets_path) {
+    if (mkdtemp(work_dir) == NULL || chdir(work_dir) != 0) {
+        fprintf(stderr, "No se pudo crear el directorio de trabajo.\n");
+        return false;
+    }
+    if (symlink(assets_path, "assets") != 0) {
+        fprintf(stderr, "No se pudo enlazar %s\n", assets_path);
+        return false;
+    }
+    if (!write_text_database("base.txt")) {
+        fprintf(stderr, "No se pudo escribir la base de datos sintetica.\n");
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+        execl(main_path, main_path, "--convert", "base.txt", "base.dat", (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s --convert fallo.\n", main_path);
+        return false;
+    }
+    unlink("base.txt");
+    return true;
+}
+
+static void clean_work_dir() {
+    remove_store();
+    unlink("base.dat");
+    unlink("assets");
+    if (chdir("/") == 0) rmdir(work_dir);
+}
+
+// --- Runs ---
+
+static void record(int label, uint64_t latency, size_t bytes) {
+    Label *entry = &labels[label];
+    entry->samples = grow(entry->samples, entry->count, &entry->capacity, sizeof(uint64_t));
+    entry->samples[entry->count++] = latency;
+    entry->bytes += bytes;
+}
+
+// Reads until the terminal has been quiet for opt_quiet_ms (or the program is gone).
+// Returns the time of the last byte, or since when nothing arrived.
+static uint64_t settle(int fd, uint64_t since, size_t *bytes, bool *closed) {
+    uint64_t last = since;
+    uint64_t give_up = since + 10000000000ull; // a screen that never stops changing
+    char buffer[1 << 16];
+    *bytes = 0;
+    *closed = false;
+    while (true) {
+        uint64_t now = now_ns();
+        uint64_t quiet_until = (last > since ? last : now) + (uint64_t)opt_quiet_ms * 1000000ull;
+        if (now >= quiet_until || now >= give_up) return last;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, (int)((quiet_until - now) / 1000000ull) + 1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) continue;
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR) continue;
+        if (length <= 0) { // EIO once the program exits and the pty's slave side closes
+            *closed = true;
+            return last;
+        }
+        *bytes += (size_t)length;
+        last = now_ns();
+        if (transcript != NULL) fwrite(buffer, 1, (size_t)length, transcript);
+    }
+}
+
+static bool run_once(const char *main_path, int startup, int shutdown) {
+    remove_store();
+    if (!copy_file("base.dat", "recycling_data.dat")) {
+        fprintf(stderr, "No se pudo copiar la base de datos.\n");
+        return false;
+    }
+
+    struct winsize size = { .ws_row = (unsigned short)opt_rows, .ws_col = (unsigned short)opt_cols };
+    int fd;
+    uint64_t start = now_ns();
+    pid_t pid = forkpty(&fd, NULL, NULL, &size);
+    if (pid < 0) {
+        fprintf(stderr, "forkpty fallo: %s\n", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        setenv("ESCDELAY", "25", 1); // otherwise every <esc> costs curses' second of waiting
+        execl(main_path, main_path, (char *)NULL);
+        _exit(127);
+    }
+
+    if (transcript != NULL) rewind(transcript);
+    size_t bytes;
+    bool closed;
+    uint64_t last = settle(fd, start, &bytes, &closed);
+    record(startup, last - start, bytes);
+
+    bool ok = !closed;
+    for (int i = 0; i < keystroke_count && ok; i++) {
+        const char *key = keystrokes[i].key;
+        uint64_t sent = now_ns();
+        if (write(fd, key, strlen(key)) != (ssize_t)strlen(key)) {
+            ok = false;
+            break;
+        }
+        last = settle(fd, sent, &bytes, &closed);
+        record(keystrokes[i].label, last - sent, bytes);
+        if (closed && i + 1 < keystroke_count) {
+            fprintf(stderr, "main termino antes de terminar el guion (paso \"%s\").\n", labels[keystrokes[i].label].name);
+            ok = false;
+        }
+    }
+
+    // The script is expected to quit: time how long the program takes to exit (the final
+    // checkpoint), giving up after a few seconds.
+    uint64_t quit = now_ns();
+    int status = 0;
+    pid_t done = 0;
+    while ((done = waitpid(pid, &status, WNOHANG)) == 0 && now_ns() - quit < 5000000000ull) {
+        char buffer[4096];
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 10) > 0 && read(fd, buffer, sizeof(buffer)) <= 0) usleep(1000);
+    }
+    if (done == 0) {
+        fprintf(stderr, "main sigue abierto al final del guion (debe terminar saliendo del menu principal); se detuvo con SIGTERM.\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, &status, 0);
+        ok = false;
+    } else {
+        record(shutdown, now_ns() - quit, 0);
+    }
+    close(fd);
+    if (ok && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        fprintf(stderr, "main termino con error (estado %d).\n", status);
+        ok = false;
+    }
+    return ok;
+}
+
+// --- Report ---
+
+static int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const Label *label, double q) {
+    if (label->count == 0) return 0;
+    double exact = q * (double)label->count; // nearest rank
+    size_t rank = (size_t)exact;
+    if (rank < exact || rank == 0) rank++;
+    return (double)label->samples[rank - 1] / 1e6;
+}
+
+// p50 of a label in a report written with -o, or a negative number if it isn't there.
+static double baseline_p50(FILE *baseline, const char *name) {
+    if (baseline == NULL) return -1;
+    rewind(baseline);
+    char line[256], label[64];
+    double p50;
+    while (fgets(line, sizeof(line), baseline) != NULL) {
+        if (sscanf(line, "%63[^\t]\t%*d\t%lf", label, &p50) == 2 && strcmp(label, name) == 0) return p50;
+    }
+    return -1;
+}
+
+// Prints the table (and writes the TSV). Returns how many labels regressed against the
+// baseline: slower p50 by more than the tolerance and by at least two milliseconds, so
+// scheduler noise on short steps doesn't fail a run.
+static int report() {
+    FILE *baseline = NULL;
+    if (opt_baseline != NULL && (baseline = fopen(opt_baseline, "r")) == NULL) {
+        fprintf(stderr, "No se pudo abrir %s\n", opt_baseline);
+    }
+    FILE *tsv = NULL;
+    if (opt_report != NULL && (tsv = fopen(opt_report, "w")) == NULL) {
+        fprintf(stderr, "No se pudo escribir %s\n", opt_report);
+    }
+
+    printf("usuarios=%d donaciones=%ld repeticiones=%d terminal=%dx%d silencio=%d ms\n\n",
+           opt_users, opt_donations, opt_runs, opt_rows, opt_cols, opt_quiet_ms);
+    printf("%-12s %6s %10s %10s %10s %12s%s\n", "paso", "teclas", "p50 ms", "p99 ms", "max ms", "bytes/tecla",
+           baseline != NULL ? "      base p50" : "");
+    if (tsv != NULL) fprintf(tsv, "paso\tteclas\tp50_ms\tp99_ms\tmax_ms\tbytes_tecla\n");
+
+    int regressions = 0;
+    for (int i = 0; i < label_count; i++) {
+        Label *label = &labels[i];
+        if (label->count == 0) continue;
+        qsort(label->samples, label->count, sizeof(uint64_t), compare_samples);
+        double p50 = percentile_ms(label, 0.50), p99 = percentile_ms(label, 0.99);
+        double max = (double)label->samples[label->count - 1] / 1e6;
+        double bytes = (double)label->bytes / (double)label->count;
+        printf("%-12s %6ld %10.3f %10.3f %10.3f %12.0f", label->name, label->keys, p50, p99, max, bytes);
+        if (tsv != NULL) {
+            fprintf(tsv, "%s\t%ld\t%.3f\t%.3f\t%.3f\t%.0f\n", label->name, label->keys, p50, p99, max, bytes);
+        }
+        double base = baseline_p50(baseline, label->name);
+        if (base >= 0) {
+            bool regressed = p50 > base * (1 + opt_tolerance / 100) && p50 - base >= 2.0;
+            printf(" %10.3f %+5.0f%%%s", base, base > 0 ? (p50 - base) * 100 / base : 0.0, regressed ? "  REGRESION" : "");
+            regressions += regressed;
+        }
+        printf("\n");
+    }
+    if (baseline != NULL) fclose(baseline);
+    if (tsv != NULL) fclose(tsv);
+    return regressions;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-m main] [-a assets] [-u usuarios] [-d donaciones] [-s semilla] [-r repeticiones]\n"
+                    "          [-f guion] [-g filasxcolumnas] [-q ms] [-o reporte.tsv] [-b base.tsv] [-x tolerancia%%] [-t salida.tty]\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "m:a:u:d:s:r:f:g:q:o:b:x:t:")) != -1) {
+        switch (option) {
+            case 'm': opt_main = optarg; break;
+            case 'a': opt_assets = optarg; break;
+            case 'u': opt_users = atoi(optarg); break;
+            case 'd': opt_donations = atol(optarg); break;
+            case 's': opt_seed = strtoull(optarg, NULL, 10); break;
+            case 'r': opt_runs = atoi(optarg); break;
+            case 'f': opt_script = optarg; break;
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &opt_rows, &opt_cols) != 2) opt_rows = 0;
+                break;
+            case 'q': opt_quiet_ms = atoi(optarg); break;
+            case 'o': opt_report = optarg; break;
+            case 'b': opt_baseline = optarg; break;
+            case 'x': opt_tolerance = atof(optarg); break;
+            case 't': opt_transcript = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (opt_users <= 0 || opt_donations < 0 || opt_runs <= 0 || opt_rows < 10 || opt_cols < 40 || opt_quiet_ms <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // The child inherits TERM; the key names in the script are looked up for the same one
+    const char *term = getenv("TERM");
+    if (term == NULL || term[0] == '\0') setenv("TERM", term = "xterm", 1);
+    int error;
+    if (setupterm((char *)term, STDOUT_FILENO, &error) != OK) {
+        fprintf(stderr, "No se encontro la descripcion de la terminal %s.\n", term);
+        return 2;
+    }
+
+    // Paths outside the work directory are made absolute before moving into it
+    char main_path[PATH_MAX], assets_path[PATH_MAX], report_path[PATH_MAX], baseline_path[PATH_MAX];
+    if (realpath(opt_main, main_path) == NULL || realpath(opt_assets, assets_path) == NULL) {
+        fprintf(stderr, "No se encontro %s o %s\n", opt_main, opt_assets);
+        return 2;
+    }
+    if (opt_report != NULL && opt_report[0] != '/' && getcwd(report_path, sizeof(report_path)) != NULL) {
+        size_t length = strlen(report_path);
+        snprintf(report_path + length, sizeof(report_path) - length, "/%s", opt_report);
+        opt_report = report_path;
+    }
+    if (opt_baseline != NULL && realpath(opt_baseline, baseline_path) != NULL) opt_baseline = baseline_path;
+    if (opt_transcript != NULL && (transcript = fopen(opt_transcript, "w")) == NULL) {
+        fprintf(stderr, "No se pudo escribir %s\n", opt_transcript);
+        return 2;
+    }
+
+    int startup = label_find("arranque");
+    if (!load_script()) return 2;
+    int shutdown = label_find("cierre");
+    if (!prepare_work_dir(main_path, assets_path)) {
+        clean_work_dir();
+        return 1;
+    }
+
+    bool ok = true;
+    for (int run = 0; run < opt_runs && ok; run++) ok = run_once(main_path, startup, shutdown);
+    clean_work_dir();
+    if (transcript != NULL) {
+        fflush(transcript);
+        if (ftruncate(fileno(transcript), ftell(transcript)) != 0) ok = false;
+        fclose(transcript);
+    }
+    if (!ok) return 1;
+    return report() > 0 ? 3 : 0;
+}
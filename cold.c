@@ -0,0 +1,460 @@
+/*
+ * File:        cold.c
+ * Project:     Crucible
+ * Description: Cold tier of the donation table: old donations sealed into compressed,
+ *              immutable blocks with per-block summaries, decoded on demand.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+ColdTier cold = { NULL, 0, NULL, 0, 0 };
+
+// --- Cold Tier ---
+// When a binary snapshot is written, donations older than COLD_AGE_DAYS are sealed into
+// blocks of up to COLD_BLOCK_RECORDS donations of one center (see the Binary Snapshot
+// section in persistence.c). They take the positions before every other donation, so
+// donation_at tells the tiers apart with one comparison. Sealed blocks are copied as they
+// are by later snapshots; only donations that aged since are encoded.
+//
+// A block's records start with a dictionary of its distinct donors (ascending ids, each
+// stored as the difference to the previous one), then per donation: the donor's index in
+// the dictionary, the timestamp as the difference to the previous donation's and each
+// quantity as the difference to the previous donation's, all as varints (zigzag for the
+// signed differences). The summary in the ColdBlock answers totals, extremes and
+// threshold counts for whole blocks, so reports only decode the blocks they must.
+
+static int write_varint(uint8_t *out, uint64_t value) {
+    int length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+static inline bool read_varint(const uint8_t **cursor, const uint8_t *end, uint64_t *value) {
+    if (*cursor < end && **cursor < 0x80) { // most quantity differences fit in one byte
+        *value = *(*cursor)++;
+        return true;
+    }
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *cursor < end; shift += 7) {
+        uint8_t byte = *(*cursor)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int compare_users(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int dictionary_index(const uint32_t *dictionary, int count, uint32_t user) {
+    int low = 0, high = count - 1;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (dictionary[mid] < user) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Encodes count (at most COLD_BLOCK_RECORDS) donations into out, which must hold
+// COLD_BLOCK_RECORDS * 48 bytes, and fills in the block's summary. The caller sets
+// offset, first and center. Returns the encoded length.
+size_t cold_encode(const Donation *records, int count, uint8_t *out, ColdBlock *block) {
+    uint32_t dictionary[COLD_BLOCK_RECORDS];
+    for (int i = 0; i < count; i++) dictionary[i] = records[i].user;
+    qsort(dictionary, count, sizeof(uint32_t), compare_users);
+    int users = 0;
+    for (int i = 0; i < count; i++) {
+        if (users == 0 || dictionary[users - 1] != dictionary[i]) dictionary[users++] = dictionary[i];
+    }
+
+    memset(block, 0, sizeof(*block));
+    block->count = (uint32_t)count;
+    block->users = (uint32_t)users;
+    block->min_timestamp = INT64_MAX;
+    block->max_timestamp = INT64_MIN;
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        block->min[m] = INT32_MAX;
+        block->max[m] = INT32_MIN;
+    }
+
+    size_t length = 0;
+    for (int u = 0; u < users; u++) length += write_varint(out + length, dictionary[u] - (u > 0 ? dictionary[u - 1] : 0));
+    for (int i = 0; i < count; i++) {
+        if (records[i].timestamp < block->min_timestamp) block->min_timestamp = records[i].timestamp;
+        if (records[i].timestamp > block->max_timestamp) block->max_timestamp = records[i].timestamp;
+    }
+
+    int64_t previous_timestamp = block->min_timestamp;
+    int64_t previous[MATERIAL_COUNT] = { 0 };
+    for (int i = 0; i < count; i++) {
+        const Donation *donation = &records[i];
+        int32_t quantities[MATERIAL_COUNT] = { donation->paper, donation->plastic, donation->aluminum };
+        length += write_varint(out + length, (uint64_t)dictionary_index(dictionary, users, donation->user));
+        length += write_varint(out + length, zigzag(donation->timestamp - previous_timestamp));
+        previous_timestamp = donation->timestamp;
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            length += write_varint(out + length, zigzag((int64_t)quantities[m] - previous[m]));
+            previous[m] = quantities[m];
+            block->sum[m] += quantities[m];
+            if (quantities[m] < block->min[m]) block->min[m] = quantities[m];
+            if (quantities[m] > block->max[m]) block->max[m] = quantities[m];
+        }
+    }
+    block->bytes = (uint32_t)length;
+    return length;
+}
+
+// Decodes the block's block->bytes encoded bytes into out (block->count donations), the
+// inverse of cold_encode. A damaged block decodes as far as it makes sense and leaves the
+// rest zeroed; it never reads past its bytes.
+void cold_decode(const uint8_t *bytes, const ColdBlock *block, Donation *out) {
+    const uint8_t *cursor = bytes;
+    const uint8_t *end = cursor + block->bytes;
+    uint32_t dictionary[COLD_BLOCK_RECORDS];
+    uint64_t value;
+    memset(out, 0, block->count * sizeof(Donation));
+
+    uint32_t user = 0;
+    for (uint32_t u = 0; u < block->users; u++) {
+        if (!read_varint(&cursor, end, &value)) return;
+        user += (uint32_t)value;
+        dictionary[u] = user;
+    }
+    int64_t timestamp = block->min_timestamp;
+    int64_t quantities[MATERIAL_COUNT] = { 0 };
+    for (uint32_t i = 0; i < block->count; i++) {
+        if (!read_varint(&cursor, end, &value) || value >= block->users) return;
+        out[i].user = dictionary[value];
+        if (!read_varint(&cursor, end, &value)) return;
+        timestamp += unzigzag(value);
+        out[i].timestamp = timestamp;
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            if (!read_varint(&cursor, end, &value)) return;
+            quantities[m] += unzigzag(value);
+        }
+        out[i].paper = (int)quantities[MATERIAL_PAPER];
+        out[i].plastic = (int)quantities[MATERIAL_PLASTIC];
+        out[i].aluminum = (int)quantities[MATERIAL_ALUMINUM];
+    }
+}
+
+static const ColdBlock* find_block(const ColdTier *tier, int position) {
+    int low = 0, high = tier->block_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (tier->blocks[mid].first <= (uint32_t)position) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return &tier->blocks[low];
+}
+
+// The last COLD_CACHE_BLOCKS blocks decoded, per thread: the UI and the checkpointer read
+// the tier at the same time.
+typedef struct {
+    uint64_t generation;
+    const ColdBlock *block;
+    Donation records[COLD_BLOCK_RECORDS];
+} DecodedBlock;
+
+static __thread DecodedBlock decoded[COLD_CACHE_BLOCKS];
+static __thread int decoded_last = 0;
+static __thread int decoded_next = 0;
+
+static bool decoded_holds(const DecodedBlock *slot, const ColdTier *tier, int position) {
+    return slot->generation == tier->generation && slot->block != NULL
+        && (uint32_t)position - slot->block->first < slot->block->count;
+}
+
+// Donation at position (below tier->count). The record stays valid until the thread has
+// decoded COLD_CACHE_BLOCKS other blocks, plenty for reading one donation at a time.
+const Donation* cold_donation(const ColdTier *tier, int position) {
+    DecodedBlock *slot = &decoded[decoded_last];
+    if (!decoded_holds(slot, tier, position)) {
+        int s = 0;
+        while (s < COLD_CACHE_BLOCKS && !decoded_holds(&decoded[s], tier, position)) s++;
+        if (s == COLD_CACHE_BLOCKS) {
+            static StatTimer timer = STAT_TIMER("cold_decode");
+            uint64_t start = stats_begin();
+            s = decoded_next;
+            decoded_next = (decoded_next + 1) % COLD_CACHE_BLOCKS;
+            const ColdBlock *block = find_block(tier, position);
+            Donation *records = decoded[s].records;
+            decoded[s].block = block;
+            decoded[s].generation = tier->generation;
+            cold_decode(tier->payload + block->offset, block, records);
+            for (uint32_t i = 0; i < block->count; i++) {
+                // a damaged dictionary naming a user this snapshot doesn't have
+                if (records[i].user >= (uint32_t)users.count) memset(&records[i], 0, sizeof(Donation));
+            }
+            stats_end(&timer, start, block->bytes);
+        }
+        decoded_last = s;
+        slot = &decoded[s];
+    }
+    return &slot->records[(uint32_t)position - slot->block->first];
+}
+
+void cold_attach(const ColdBlock *blocks, int block_count, const uint8_t *payload, int count) {
+    static uint64_t generations = 0;
+    cold.blocks = blocks;
+    cold.block_count = block_count;
+    cold.payload = payload;
+    cold.count = count;
+    cold.generation = ++generations;
+}
+
+void cold_free() {
+    cold.blocks = NULL;
+    cold.block_count = 0;
+    cold.payload = NULL;
+    cold.count = 0;
+}
+
+// The blocks must tile the cold positions in order, grouped by ascending center, and stay
+// inside the payload.
+bool cold_blocks_valid(const ColdBlock *blocks, uint64_t block_count, uint64_t payload_length, uint64_t count) {
+    uint64_t next = 0;
+    for (uint64_t b = 0; b < block_count; b++) {
+        const ColdBlock *block = &blocks[b];
+        if (block->first != next || block->count == 0 || block->count > COLD_BLOCK_RECORDS
+            || block->users == 0 || block->users > block->count || block->center >= MAX_CENTERS
+            || (b > 0 && block->center < blocks[b - 1].center)
+            || block->offset > payload_length || block->bytes > payload_length - block->offset) {
+            return false;
+        }
+        next += block->count;
+    }
+    return next == count;
+}
+
+// First position at or after position whose donation may be user's: cold blocks whose
+// dictionary lacks the user are stepped over without decoding them.
+int cold_skip_user(int position, uint32_t user) {
+    while (position < cold.count) {
+        const ColdBlock *block = find_block(&cold, position);
+        if ((uint32_t)position != block->first) return position; // inside a block already checked
+
+        const uint8_t *cursor = cold.payload + block->offset;
+        const uint8_t *end = cursor + block->bytes;
+        uint32_t id = 0;
+        uint64_t value;
+        for (uint32_t u = 0; u < block->users && read_varint(&cursor, end, &value); u++) {
+            id += (uint32_t)value;
+            if (id >= user) break;
+        }
+        if (id == user) return position;
+        position = (int)(block->first + block->count);
+    }
+    return position;
+}
+
+// Distinct quantities of one material over the whole tier, ascending, with how many donations
+// reach each one. The tier never changes while it is mapped, so the tables are counted once,
+// block by block (the UI does it while idle), and threshold counts become a binary search.
+typedef struct {
+    int count;         // < 0: too many distinct quantities, counted block by block instead
+    int32_t *values;
+    int64_t *at_least; // while counting: donations with exactly values[i]
+} QuantityTable;
+
+static struct {
+    uint64_t generation; // of the tier the tables were counted from
+    int next_block;
+    bool ready;
+    QuantityTable tables[MATERIAL_COUNT];
+    int32_t *scratch_values;
+    int64_t *scratch_counts;
+} quantities;
+
+static int compare_quantities(const void *a, const void *b) {
+    int32_t x = *(const int32_t*)a, y = *(const int32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int32_t donation_quantity(const Donation *donation, Material material) {
+    return material == MATERIAL_PAPER ? donation->paper
+        : material == MATERIAL_PLASTIC ? donation->plastic : donation->aluminum;
+}
+
+// First index of the table whose value is at least value, table->count if there is none.
+static int quantity_index(const QuantityTable *table, int32_t value) {
+    int low = 0, high = table->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (table->values[mid] < value) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void drop_table(QuantityTable *table) {
+    free(table->values);
+    free(table->at_least);
+    table->values = NULL;
+    table->at_least = NULL;
+    table->count = -1;
+}
+
+static void quantities_reset() {
+    quantities.generation = cold.generation;
+    quantities.next_block = 0;
+    quantities.ready = false;
+    if (quantities.scratch_values == NULL) quantities.scratch_values = malloc(COLD_DISTINCT_QUANTITIES * sizeof(int32_t));
+    if (quantities.scratch_counts == NULL) quantities.scratch_counts = malloc(COLD_DISTINCT_QUANTITIES * sizeof(int64_t));
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        QuantityTable *table = &quantities.tables[m];
+        if (table->values == NULL) table->values = malloc(COLD_DISTINCT_QUANTITIES * sizeof(int32_t));
+        if (table->at_least == NULL) table->at_least = malloc(COLD_DISTINCT_QUANTITIES * sizeof(int64_t));
+        table->count = 0;
+        if (table->values == NULL || table->at_least == NULL
+            || quantities.scratch_values == NULL || quantities.scratch_counts == NULL) {
+            drop_table(table);
+        }
+    }
+}
+
+// Merges sorted quantities into the table's (value, count) pairs through the scratch arrays.
+// Returns false once there would be more than COLD_DISTINCT_QUANTITIES values.
+static bool merge_quantities(QuantityTable *table, const int32_t *sorted, int count) {
+    int32_t *merged_values = quantities.scratch_values;
+    int64_t *merged_counts = quantities.scratch_counts;
+    int merged = 0, a = 0, b = 0;
+    while (a < table->count || b < count) {
+        if (merged == COLD_DISTINCT_QUANTITIES) return false;
+        if (b == count || (a < table->count && table->values[a] < sorted[b])) {
+            merged_values[merged] = table->values[a];
+            merged_counts[merged++] = table->at_least[a++];
+            continue;
+        }
+        int32_t value = sorted[b];
+        int64_t same = 0;
+        while (b < count && sorted[b] == value) {
+            same++;
+            b++;
+        }
+        if (a < table->count && table->values[a] == value) same += table->at_least[a++];
+        merged_values[merged] = value;
+        merged_counts[merged++] = same;
+    }
+    memcpy(table->values, merged_values, merged * sizeof(int32_t));
+    memcpy(table->at_least, merged_counts, merged * sizeof(int64_t));
+    table->count = merged;
+    return true;
+}
+
+// Counts up to blocks more blocks into the quantity tables; true once they cover the whole
+// tier. The UI calls it while idle so the first statistics report doesn't decode every block.
+bool cold_tables_step(int blocks) {
+    if (cold.block_count == 0) return true;
+    if (quantities.generation != cold.generation) quantities_reset();
+    if (quantities.ready) return true;
+    static StatTimer timer = STAT_TIMER("cold_tables_step");
+    uint64_t start = stats_begin();
+
+    int end = cold.block_count - quantities.next_block > blocks ? quantities.next_block + blocks : cold.block_count;
+    int32_t missing[COLD_BLOCK_RECORDS];
+    for (int b = quantities.next_block; b < end; b++) {
+        const ColdBlock *block = &cold.blocks[b];
+        const Donation *records = cold_donation(&cold, (int)block->first); // the whole block, decoded
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            QuantityTable *table = &quantities.tables[m];
+            if (table->count < 0) continue;
+            // Quantities already in the table are counted in place; only new ones are sorted in.
+            int missing_count = 0;
+            for (uint32_t i = 0; i < block->count; i++) {
+                int32_t value = donation_quantity(&records[i], (Material)m);
+                int v = quantity_index(table, value);
+                if (v < table->count && table->values[v] == value) {
+                    table->at_least[v]++;
+                } else {
+                    missing[missing_count++] = value;
+                }
+            }
+            if (missing_count == 0) continue;
+            qsort(missing, missing_count, sizeof(int32_t), compare_quantities);
+            if (!merge_quantities(table, missing, missing_count)) drop_table(table);
+        }
+    }
+    quantities.next_block = end;
+
+    if (end == cold.block_count) {
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            QuantityTable *table = &quantities.tables[m];
+            for (int v = table->count - 2; v >= 0; v--) table->at_least[v] += table->at_least[v + 1];
+        }
+        quantities.ready = true;
+    }
+    stats_end(&timer, start, 0);
+    return quantities.ready;
+}
+
+// One material over the whole cold tier, from the block summaries and the quantity table.
+// It never builds the table itself: until the idle steps finish it (or without one) blocks
+// are counted whole or skipped by their min/max and only those that straddle the threshold
+// are decoded.
+void cold_summarize(Material material, int32_t threshold, MaterialSummary *out) {
+    out->count = 0;
+    out->sum = 0;
+    out->min = INT32_MAX;
+    out->max = INT32_MIN;
+    out->at_least = 0;
+    if (cold.count == 0) return;
+
+    const QuantityTable *table = &quantities.tables[material];
+    bool counted = quantities.ready && quantities.generation == cold.generation && table->count >= 0;
+    if (counted) {
+        int v = quantity_index(table, threshold);
+        if (v < table->count) out->at_least = table->at_least[v];
+    }
+    for (int b = 0; b < cold.block_count; b++) {
+        const ColdBlock *block = &cold.blocks[b];
+        out->count += block->count;
+        out->sum += block->sum[material];
+        if (block->min[material] < out->min) out->min = block->min[material];
+        if (block->max[material] > out->max) out->max = block->max[material];
+        if (counted) continue;
+        if (block->min[material] >= threshold) {
+            out->at_least += block->count;
+        } else if (block->max[material] >= threshold) {
+            for (uint32_t i = 0; i < block->count; i++) {
+                if (donation_quantity(cold_donation(&cold, (int)(block->first + i)), material) >= threshold) {
+                    out->at_least++;
+                }
+            }
+        }
+    }
+}
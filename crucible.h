@@ -0,0 +1,556 @@
+/*
+ * File:        crucible.h
+ * Project:     Crucible
+ * Description: Data layer shared by the UI, the headless commands and the benchmarks:
+ *              record store, aggregates and timeline, columnar reports, user search,
+ *              persistence and instrumentation.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#ifndef CRUCIBLE_H
+#define CRUCIBLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// --- constants ---
+#define MAX_NAME_LENGTH 50
+#define MAX_CONTROL_NUMBER_LENGTH 20
+
+// collection centers are numbered 1 to MAX_CENTERS - 1; 0 holds users registered without one
+#define MAX_CENTERS 256
+
+// records live in fixed-size chunks so pointers stay valid while the store grows
+#define ARENA_CHUNK_SHIFT 12
+#define ARENA_CHUNK_SIZE (1 << ARENA_CHUNK_SHIFT)
+#define INDEX_INITIAL_CAPACITY 256
+
+// how many donors the leaderboard can list per material
+#define LEADERBOARD_MAX 50
+
+// per-user donation index, see history.c: positions per chunk (a chunk is 32 bytes)
+#define HISTORY_CHUNK_POSITIONS 7
+
+// time rollups span at most this many days; donations outside count as undated
+#define TIMELINE_MAX_DAYS 73050
+
+// journal tuning: fsync after this many records or seconds, fold into the snapshot after
+// JOURNAL_CHECKPOINT_RECORDS so replay on startup stays short
+#define JOURNAL_SYNC_BATCH 32
+#define JOURNAL_SYNC_INTERVAL 2
+#define JOURNAL_CHECKPOINT_RECORDS 4096
+
+// lock-free reads of the shared header give up after this many torn reads and retry on the
+// next poll; a writer that died mid-update is repaired by the next one to take the lock
+#define SHARED_READ_ATTEMPTS 1000
+
+// records that may wait for the writer thread's fsync before inserts block
+#define PERSIST_QUEUE_SIZE 256
+
+// user search: inserts wait in an unsorted tail of this many entries before being merged;
+// the initial build advances SEARCH_BUILD_STEP entries per step, sorting SEARCH_RUN at a time
+#define SEARCH_TAIL_MAX 1024
+#define SEARCH_BUILD_STEP 16384
+#define SEARCH_RUN 4096
+
+// instrumentation: latency histogram buckets per timer, see stats.c
+#define STATS_BUCKETS 256
+
+// text loader: bytes per parse chunk and most threads parsing at once, see persistence.c
+#define TEXT_LOAD_CHUNK (1 << 20)
+#define TEXT_LOAD_THREADS 8
+
+// batch import: rows per durable commit and the longest CSV line we accept
+#define IMPORT_BATCH_ROWS 1000
+#define IMPORT_MAX_LINE 1024
+
+// server tuning: request bytes buffered per client, answers held for a client that doesn't
+// read them, clients at once, and loop rounds a client may have waiting for the disk
+#define SERVER_INPUT_BUFFER 16384
+#define SERVER_OUTPUT_MAX (1 << 20)
+#define SERVER_MAX_CLIENTS 1024
+#define SERVER_PENDING_ROUNDS 16
+#define SERVER_EVENTS 256
+
+// binary snapshot format, see the Binary Snapshot section
+#define BINARY_MAGIC "CRUCIBLE"
+#define BINARY_VERSION 5
+#define BINARY_BYTE_ORDER 0x01020304u
+
+// cold tier, see cold.c: a binary snapshot seals donations older than COLD_AGE_DAYS into
+// compressed blocks of up to COLD_BLOCK_RECORDS; each thread keeps COLD_CACHE_BLOCKS decoded
+// blocks, and threshold counts use a table of distinct quantities while there are at most
+// COLD_DISTINCT_QUANTITIES of them per material
+#define COLD_AGE_DAYS 180
+#define COLD_BLOCK_RECORDS 1024
+#define COLD_CACHE_BLOCKS 8
+#define COLD_DISTINCT_QUANTITIES 65536
+
+// --- Data Structures ---
+typedef struct {
+    char control_number[MAX_CONTROL_NUMBER_LENGTH];
+    char name[MAX_NAME_LENGTH];
+    uint8_t center; // collection center the user registered at
+} User;
+
+// A user's id is its position in users, assigned at registration and never reused, so
+// donations reference their donor by id and per-user data is an array indexed by it.
+typedef struct {
+    uint32_t user;     // donor's id
+    int paper;
+    int plastic;
+    int aluminum;
+    int64_t timestamp; // seconds since the epoch; 0 for donations recorded before we kept it
+} Donation;
+
+// Growable record storage: a table of chunks, each holding ARENA_CHUNK_SIZE records.
+// The first base_count records may come straight from a memory-mapped binary snapshot;
+// those before base_first aren't in base but elsewhere (the donations' cold tier).
+typedef struct {
+    size_t record_size;
+    char *base;
+    int base_first;
+    int base_count;
+    char **chunks;
+    int chunk_count;
+    int chunk_capacity;
+    int count;
+} RecordArena;
+
+// Open-addressing hash index over users, keyed by control_number.
+typedef struct {
+    uint32_t hash;
+    int32_t user; // user position + 1, 0 means empty slot
+} IndexSlot;
+
+typedef struct {
+    IndexSlot *slots;
+    uint32_t capacity; // always a power of two
+    uint32_t count;
+    bool mapped;       // slots point into the snapshot mapping, don't free them
+} UserIndex;
+
+// Donation materials, used to index per-material totals.
+typedef enum {
+    MATERIAL_PAPER,
+    MATERIAL_PLASTIC,
+    MATERIAL_ALUMINUM,
+    MATERIAL_COUNT
+} Material;
+
+typedef struct {
+    int64_t kg[MATERIAL_COUNT];
+} MaterialTotals;
+
+// Indexed max-heap of user positions ordered by their total of one material. position[u]
+// is where user u sits in items (-1 if absent), so a changed total is re-sifted in O(log n).
+typedef struct {
+    Material material;
+    int *items;
+    int *position;
+    int count;
+} DonorHeap;
+
+// Struct-of-arrays copy of the donation table for reporting: each column is one contiguous
+// array, so a scan over one material only streams that material through the cache.
+typedef struct {
+    bool enabled;
+    int32_t *paper;
+    int32_t *plastic;
+    int32_t *aluminum;
+    int32_t *user; // donor's id
+    int first;     // position of row 0; the cold tier before it is read from its summaries
+    int count;
+    int capacity;
+} DonationColumns;
+
+// Reduction kernels over one int32 column, picked once for the CPU we run on.
+typedef struct {
+    const char *name;
+    int64_t (*sum)(const int32_t *values, size_t n);
+    void (*min_max)(const int32_t *values, size_t n, int32_t *min, int32_t *max);
+    size_t (*count_at_least)(const int32_t *values, size_t n, int32_t threshold);
+} ColumnKernels;
+
+// Calendar periods the donation timeline is rolled up by. Weeks start on Monday.
+typedef enum {
+    PERIOD_DAY,
+    PERIOD_WEEK,
+    PERIOD_MONTH,
+    PERIOD_COUNT
+} Period;
+
+typedef struct {
+    MaterialTotals totals;
+    int count; // donations
+} RollupBucket;
+
+// Totals per period, buckets[i] holding period number first + i (see timeline_period).
+typedef struct {
+    int first;
+    int count;
+    int capacity;
+    RollupBucket *buckets;
+} Rollup;
+
+// A dated donation in the time index.
+typedef struct {
+    int64_t timestamp;
+    int32_t donation; // position in the store
+} TimeEntry;
+
+// Donations by local calendar date: rollups answer whole days, weeks and months, the
+// time-ordered index the partial days at the edges of a range.
+typedef struct {
+    Rollup rollups[PERIOD_COUNT];
+    TimeEntry *by_time;
+    int count;
+    int capacity;
+    int sorted;       // by_time[0, sorted) is in order; a shard merge appends after it
+    RollupBucket undated;
+} Timeline;
+
+// One link of a user's donation list: up to HISTORY_CHUNK_POSITIONS positions, oldest first.
+typedef struct {
+    int32_t next; // chunk index, -1 at the end of the list
+    int32_t positions[HISTORY_CHUNK_POSITIONS];
+} HistoryChunk;
+
+typedef struct {
+    int32_t head; // first and last chunk, -1 while the user has no donations
+    int32_t tail;
+    int32_t count;
+} HistoryList;
+
+// Each user's donation positions as a list of chunks taken from one arena, see history.c.
+typedef struct {
+    HistoryList *lists; // indexed by user position
+    int capacity;
+    RecordArena chunks;
+} UserHistory;
+
+// Running totals, updated on every insert once built by load_data.
+typedef struct {
+    bool ready;
+    MaterialTotals global;
+    MaterialTotals *per_user; // indexed by user position
+    int capacity;             // users covered by per_user and the heaps' position arrays
+    DonorHeap leaders[MATERIAL_COUNT];
+    Timeline timeline;
+} Aggregates;
+
+// Append-only log of inserts since the last checkpoint.
+typedef struct {
+    FILE *file;
+    long checkpoint_id; // snapshot this journal extends
+    int records;        // records appended since that snapshot
+    int unsynced;       // records written but not yet fsync'd
+    time_t last_sync;
+    bool batching;      // bulk import: the caller decides when to flush and checkpoint
+    long offset;        // journal bytes already applied to the store, ours and other processes'
+} Journal;
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_BINARY
+} DataFormat;
+
+// On-disk header of a binary snapshot. Records are stored with the in-memory User,
+// Donation and IndexSlot layouts in native byte order, so the file is used in place.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t user_record_size;
+    uint32_t donation_record_size;
+    int64_t checkpoint_id;
+    uint64_t user_count;
+    uint64_t user_offset;
+    uint64_t index_capacity;
+    uint64_t index_offset;
+    uint64_t donation_count;
+    uint64_t donation_offset;
+    uint64_t section_count;
+    uint64_t section_offset;
+    uint64_t cold_count;     // donations sealed in the cold tier, positions before the others
+    uint64_t block_count;
+    uint64_t block_offset;
+    uint64_t payload_offset;
+    uint64_t payload_length;
+} BinaryHeader;
+
+// The donations of a binary snapshot are grouped by their donor's center, one section per
+// center, so a kiosk can count its own center's at startup and leave the rest of the
+// mapping untouched until a view needs the whole network (see shards.c).
+typedef struct {
+    uint32_t center;
+    uint32_t reserved;
+    uint64_t first; // position of the section's first donation
+    uint64_t count;
+} ShardSection;
+
+// One sealed block of the cold tier: up to COLD_BLOCK_RECORDS donations of one center,
+// compressed, and a summary that answers totals and extremes without decoding them.
+typedef struct {
+    uint64_t offset;  // of the encoded records in the payload
+    uint32_t first;   // position of the block's first donation
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t center;
+    uint32_t users;   // distinct donors, the dictionary the records refer to
+    uint32_t reserved;
+    int64_t min_timestamp;
+    int64_t max_timestamp;
+    int64_t sum[MATERIAL_COUNT];
+    int32_t min[MATERIAL_COUNT];
+    int32_t max[MATERIAL_COUNT];
+} ColdBlock;
+
+// The cold tier of the mapped snapshot: donations [0, count), immutable until the next load.
+typedef struct {
+    const ColdBlock *blocks;
+    int block_count;
+    const uint8_t *payload;
+    int count;
+    uint64_t generation; // tells decoded blocks of a previous mapping apart
+} ColdTier;
+
+// One material over a set of donations, see cold_summarize.
+typedef struct {
+    int64_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    int64_t at_least; // donations with at least the threshold asked for
+} MaterialSummary;
+
+// Which centers' donations the aggregates count. Donations from the journal and new inserts
+// come after the sections and are sorted out by their donor's center.
+typedef struct {
+    int home;                     // this kiosk's center: new users get it, counted from the start
+    bool loaded[MAX_CENTERS];
+    bool all_loaded;
+    const ShardSection *sections; // in the snapshot mapping, ordered by first
+    int section_count;
+    int sectioned;                // donations [0, sectioned) are covered by the sections
+} Shards;
+
+// Mapped by every process using the database (SHARED_FILE): the journal all of them append
+// to and how far it is committed. Written under the store lock, read under a seqlock:
+// sequence is odd while an update is in progress.
+typedef struct {
+    uint32_t sequence;
+    uint32_t reserved;
+    int64_t checkpoint_id;
+    int64_t journal_length;
+} SharedHeader;
+
+// One sorted search index, see search.c.
+typedef struct {
+    uint64_t key;   // first eight folded bytes, big-endian, so integer order is text order
+    int32_t user;
+} SearchEntry;
+
+typedef struct {
+    SearchEntry *entries;
+    int sorted;     // entries[0, sorted) are in order, the rest are recent inserts
+    int count;
+    int capacity;
+    size_t field;   // offset of the User field the index orders by
+} SearchIndex;
+
+typedef struct {
+    bool ready;
+    SearchIndex control;
+    SearchIndex name;
+} UserSearch;
+
+// Users matching a search: a run of the index's sorted part followed by recent inserts.
+typedef struct {
+    const SearchIndex *index;
+    int first;
+    int run;
+    int tail[SEARCH_TAIL_MAX];
+    int tail_count;
+    int total;
+} SearchResult;
+
+// A named timer: how often something ran, how long it took and how many bytes it moved.
+// Declared static with STAT_TIMER and registered the first time it records.
+typedef struct StatTimer {
+    const char *name;
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t bytes;
+    uint64_t buckets[STATS_BUCKETS];
+    bool registered;
+    struct StatTimer *next;
+} StatTimer;
+
+#define STAT_TIMER(timer_name) { .name = (timer_name) }
+
+// Acknowledgement that a record reached the disk, see persist_notify.
+typedef void (*PersistCallback)(void *context);
+
+#define ARENA_INIT(type) { sizeof(type), NULL, 0, 0, NULL, 0, 0, 0 }
+
+// --- Global State ---
+extern RecordArena users;
+extern RecordArena donations;
+extern UserIndex user_index;
+extern Journal journal;
+extern Aggregates aggregates;
+extern UserHistory user_history;
+extern DonationColumns columns;
+extern UserSearch user_search;
+extern Shards shards;
+extern ColdTier cold;
+extern DataFormat data_format;
+extern void *snapshot_map;
+extern size_t snapshot_map_length;
+extern bool stats_enabled;
+
+// --- data file paths ---
+extern const char* DATA_FILE;
+extern const char* JOURNAL_FILE;
+extern const char* SHARED_FILE;
+extern const char* SERVER_SOCKET_FILE;
+
+// Record store functions
+static inline void* arena_at(const RecordArena *arena, int i) {
+    if (i < arena->base_count) return arena->base + (size_t)(i - arena->base_first) * arena->record_size;
+    i -= arena->base_count;
+    return arena->chunks[i >> ARENA_CHUNK_SHIFT] + (size_t)(i & (ARENA_CHUNK_SIZE - 1)) * arena->record_size;
+}
+void* arena_push(RecordArena *arena);
+bool arena_write(const RecordArena *arena, FILE *file);
+void arena_free(RecordArena *arena);
+User* user_at(int i);
+const Donation* donation_at(int i);
+int find_user_position(const char* control_number);
+User* find_user(const char* control_number);
+User* add_user(const char* control_number, const char* name);
+User* add_user_at(const char* control_number, const char* name, int center);
+Donation* add_donation(const char* control_number, int paper, int plastic, int aluminum, int64_t timestamp);
+void free_store();
+
+// Aggregate functions
+void build_aggregates();
+void aggregate_donation(const Donation *donation);
+void aggregate_range(int first, int count, const bool *centers);
+void rebuild_leaders();
+void free_aggregates();
+int top_donors(Material material, int k, int *out);
+
+// Per-user donation index
+void user_history_append(int user, int position);
+int user_history_count(int user);
+void user_history_copy(int user, int *out);
+void user_history_free();
+
+// Donation timeline: calendar helpers, rollups and date-range queries
+int timeline_day(int64_t timestamp);
+int64_t timeline_day_start(int day);
+void timeline_date(int day, int *year, int *month, int *mday);
+int timeline_period(Period period, int day);
+int timeline_period_start(Period period, int number);
+bool timeline_build();
+void timeline_add(const Donation *donation, int position);
+void timeline_append(const Donation *donation, int position);
+void timeline_merge();
+void timeline_free();
+void timeline_range(int64_t from, int64_t to, RollupBucket *out);
+
+// Per-center shards
+static inline bool shard_loaded(int center) {
+    return shards.all_loaded || shards.loaded[center];
+}
+int donation_center(const Donation *donation);
+int shard_skip(int position);
+void shards_load_all();
+
+// Cold tier
+const Donation* cold_donation(const ColdTier *tier, int position);
+void cold_attach(const ColdBlock *blocks, int block_count, const uint8_t *payload, int count);
+void cold_free();
+bool cold_blocks_valid(const ColdBlock *blocks, uint64_t block_count, uint64_t payload_length, uint64_t count);
+size_t cold_encode(const Donation *records, int count, uint8_t *out, ColdBlock *block);
+void cold_decode(const uint8_t *bytes, const ColdBlock *block, Donation *out);
+int cold_skip_user(int position, uint32_t user);
+bool cold_tables_step(int blocks);
+void cold_summarize(Material material, int32_t threshold, MaterialSummary *out);
+
+// Columnar storage and reporting kernels
+bool columns_build_step(int rows);
+bool columns_enable();
+bool columns_append(const Donation *donation);
+void columns_free();
+const int32_t* material_column(Material material);
+const ColumnKernels* column_kernels();
+
+// User search
+size_t search_fold(const char *text, char *out, size_t size);
+bool search_build_step();
+bool search_enable();
+void search_add_user(int user);
+void search_free();
+bool search_users(const char *query, SearchResult *result);
+int search_result_user(const SearchResult *result, int row);
+
+// Data persistence functions
+void save_data();
+bool load_data();
+bool read_snapshot(const char* path);
+bool write_snapshot(const char* path, DataFormat format, long checkpoint_id);
+int convert_data_file(const char* source, const char* destination);
+void journal_append_user(const User *user);
+void journal_append_donation(const Donation *donation);
+void journal_sync();
+void journal_close();
+
+// Multi-process access
+void store_lock();
+void store_unlock();
+bool store_refresh();
+
+// Background writer
+bool persist_start();
+int persist_event_fd();
+void persist_notify(PersistCallback callback, void *context);
+void persist_poll();
+void persist_stop();
+
+// Instrumentation. With stats off, stats_begin returns 0 without reading the clock and
+// stats_end does nothing, so instrumented code pays one branch per call.
+uint64_t stats_clock();
+void stats_enable(bool enabled);
+void stats_record(StatTimer *timer, uint64_t elapsed, uint64_t bytes);
+uint64_t stats_percentile(const StatTimer *timer, double q);
+const StatTimer* stats_first();
+const StatTimer* stats_next(const StatTimer *timer);
+void stats_write_json(FILE *file);
+
+static inline uint64_t stats_begin() {
+    return stats_enabled ? stats_clock() : 0;
+}
+
+static inline void stats_end(StatTimer *timer, uint64_t start, uint64_t bytes) {
+    if (start != 0) stats_record(timer, stats_clock() - start, bytes);
+}
+
+// Headless batch mode
+bool parse_quantity(const char* text, int *value);
+bool valid_text_field(const char* text, size_t max_length);
+int run_import(const char* path);
+int run_export(const char* path);
+
+// Local socket server
+int run_server(const char* path);
+
+#endif
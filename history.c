@@ -0,0 +1,90 @@
+/*
+ * File:        history.c
+ * Project:     Crucible
+ * Description: Per-user index of donation positions, so one person's donations are listed
+ *              without scanning the donation table.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+UserHistory user_history = { NULL, 0, ARENA_INIT(HistoryChunk) };
+
+// --- User History Index ---
+// Every user's donation positions, oldest first, as a linked list of fixed-size chunks
+// from one arena: an append fills the tail chunk or links a new one, and a walk reads
+// HISTORY_CHUNK_POSITIONS positions per chunk. It covers the same donations as the
+// aggregates (those of the loaded centers, see shards.c): build_aggregates and
+// aggregate_range fill it and add_donation appends to it. Positions change when a snapshot
+// regroups the donations, and so the index is rebuilt with the aggregates on every load.
+
+// Grows the lists to cover every registered user.
+static bool lists_reserve(int needed) {
+    if (needed <= user_history.capacity) return true;
+
+    int capacity = user_history.capacity ? user_history.capacity : 1024;
+    while (capacity < needed) capacity *= 2;
+    HistoryList *lists = realloc(user_history.lists, capacity * sizeof(HistoryList));
+    if (lists == NULL) return false;
+    for (int u = user_history.capacity; u < capacity; u++) lists[u] = (HistoryList){ -1, -1, 0 };
+    user_history.lists = lists;
+    user_history.capacity = capacity;
+    return true;
+}
+
+static HistoryChunk* chunk_at(int32_t index) {
+    return (HistoryChunk*)arena_at(&user_history.chunks, index);
+}
+
+void user_history_append(int user, int position) {
+    if (!lists_reserve(users.count > user ? users.count : user + 1)) return;
+    HistoryList *list = &user_history.lists[user];
+    int slot = list->count % HISTORY_CHUNK_POSITIONS;
+    HistoryChunk *chunk;
+    if (slot == 0) {
+        chunk = arena_push(&user_history.chunks);
+        if (chunk == NULL) return;
+        int32_t index = user_history.chunks.count - 1;
+        chunk->next = -1;
+        if (list->count == 0) {
+            list->head = index;
+        } else {
+            chunk_at(list->tail)->next = index;
+        }
+        list->tail = index;
+    } else {
+        chunk = chunk_at(list->tail);
+    }
+    chunk->positions[slot] = position;
+    list->count++;
+}
+
+int user_history_count(int user) {
+    return user < user_history.capacity ? user_history.lists[user].count : 0;
+}
+
+// Copies the user's positions, oldest first, into out (user_history_count of them).
+void user_history_copy(int user, int *out) {
+    int remaining = user_history_count(user);
+    for (int32_t index = remaining > 0 ? user_history.lists[user].head : -1; index >= 0 && remaining > 0; ) {
+        const HistoryChunk *chunk = chunk_at(index);
+        int n = remaining < HISTORY_CHUNK_POSITIONS ? remaining : HISTORY_CHUNK_POSITIONS;
+        memcpy(out, chunk->positions, n * sizeof(int32_t));
+        out += n;
+        remaining -= n;
+        index = chunk->next;
+    }
+}
+
+void user_history_free() {
+    free(user_history.lists);
+    user_history.lists = NULL;
+    user_history.capacity = 0;
+    arena_free(&user_history.chunks);
+}
@@ -42,11 +42,23 @@
     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _XOPEN_SOURCE 700 // wcwidth() for the text layout
 #include <ncurses.h>
 #include <string.h>
 #include <stdlib.h>
 #include <locale.h>
+#include <wchar.h>
 #include <stdio.h> // file I/O
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "crucible.h" // data layer: store, aggregates, persistence
 
 // --- color Pair Definitions ---
 #define COLOR_PAIR_DEFAULT 1
@@ -56,273 +68,574 @@
 #define COLOR_PAIR_INPUT 5
 #define COLOR_PAIR_BORDER 6
 
-// --- constants ---
-#define MAX_USERS 100
-#define MAX_DONATIONS 100
-#define MAX_NAME_LENGTH 50
-#define MAX_CONTROL_NUMBER_LENGTH 20
+// --- Screen Layout ---
+#define NAVBAR_HEIGHT 7
+#define FOOTER_HEIGHT 3
+
+// asset cache: files kept in memory, re-checked on inotify events or every few seconds
+#define MAX_CACHED_ASSETS 16
+#define ASSET_RECHECK_SECONDS 1
+
+// while waiting for a key, check this often for records other kiosks added; live views get
+// KEY_STORE_CHANGED so they can redraw, views showing assets KEY_ASSETS_CHANGED
+#define STORE_POLL_MS 500
+#define KEY_STORE_CHANGED (KEY_MAX + 1)
+#define KEY_ASSETS_CHANGED (KEY_MAX + 2)
+#define EVENT_STORE 1
+#define EVENT_ASSETS 2
+
+// idle work starts this long after the last key and runs in slices of at most
+// IDLE_SLICE_US, looking for input in between, so a keystroke never waits behind it
+#define IDLE_DELAY_MS 250
+#define IDLE_SLICE_US 4000
+#define IDLE_COLUMN_ROWS 16384
+#define IDLE_COLD_BLOCKS 8
+
+// info views: text column width (narrower on small terminals)
+#define INFO_TEXT_WIDTH 70
+
+// performance overlay: drawn over the top-right corner of the content area
+#define STATS_OVERLAY_WIDTH 64
 
 // --- Data Structures ---
+// One screen row of wrapped text: length bytes starting at start, inside an asset's text.
 typedef struct {
-    char control_number[MAX_CONTROL_NUMBER_LENGTH];
-    char name[MAX_NAME_LENGTH];
-} User;
+    const char *start;
+    int length;
+} TextRow;
 
+// A text asset loaded once and split into lines. text owns the bytes; every '\n' in it
+// was replaced by '\0' so lines[] point straight into it. rows[] is the same text wrapped
+// to wrap_width cells, rebuilt only when the file or the width changes.
 typedef struct {
-    char user_control_number[MAX_CONTROL_NUMBER_LENGTH];
-    int paper;
-    int plastic;
-    int aluminum;
-} Donation;
+    const char *path;
+    char *text;
+    const char **lines;
+    int line_count;
+    TextRow *rows;
+    int row_count;
+    int row_capacity;
+    int wrap_width;
+    unsigned wrap_version;
+    struct timespec mtime;
+    off_t size;
+    unsigned version; // bumped on every (re)load so views can tell the content changed
+    bool loaded;
+    bool check;  // may have changed on disk, stat it before the next use
+    int watch;   // inotify watch on the parent directory, -1 if none
+} Asset;
 
-// --- Global State ---
-User users[MAX_USERS];
-int user_count = 0;
+typedef struct {
+    Asset entries[MAX_CACHED_ASSETS];
+    int count;
+    int notify_fd; // -1 when inotify is unavailable, then we fall back to polling mtimes
+    time_t last_check;
+} AssetCache;
+
+// The screen is three persistent windows. Views draw only into content; navbar and footer
+// are repainted when flagged dirty (resize, asset reload), not on every keypress.
+typedef struct {
+    WINDOW *navbar;
+    WINDOW *content;
+    WINDOW *footer;
+    bool navbar_dirty;
+    bool footer_dirty;
+    unsigned logo_version;   // asset versions the navbar was last drawn with
+    unsigned banner_version;
+    char status[48];         // shown at the right of the footer, e.g. save confirmations
+    WINDOW *stats;           // performance overlay, NULL while hidden
+} Screen;
+
+// Scroll state of a table view: which rows are on screen and which one is highlighted.
+typedef struct {
+    int total;
+    int top;
+    int selected;
+    int height;
+} ListView;
+
+// Formats one table row into buffer; called only for rows that are actually visible.
+typedef void (*TableRowFormatter)(int row, char *buffer, size_t size);
+// Re-collects a table's rows after the store was reloaded, for tables kept outside it.
+typedef void (*TableRefresh)();
+
+// A centered column of buttons; the main menu and the info submenu share it. Items for
+// which visible() returns false are skipped (visible NULL shows them all).
+typedef struct {
+    const char *title;
+    const char **items;
+    int count;
+    int highlight;
+    bool (*visible)(int item);
+} Menu;
+
+#define MENU_NONE -1 // the key didn't choose anything
+#define MENU_BACK -2
+
+// One bounded step of work done while nobody is typing; returns true when nothing is left.
+typedef bool (*IdleTask)();
 
-Donation donations[MAX_DONATIONS];
-int donation_count = 0;
+// --- Global State ---
+AssetCache assets = { .count = 0, .notify_fd = -1, .last_check = 0 };
+Screen screen = { NULL, NULL, NULL, true, true, 0, 0, "", NULL };
 
 char logged_in_user[MAX_CONTROL_NUMBER_LENGTH] = "";
 
+// --stats: where to write the JSON report on exit ("" for stderr), NULL when not asked for
+const char* stats_report = NULL;
+
 // ---file paths ---
 const char* LOGO_FILE = "assets/images/logo.txt";
 const char* BANNER_FILE = "assets/images/banner.txt";
 const char* COMO_RECICLAR_FILE = "assets/news/como_reciclar.txt";
 const char* NOTICIAS_FILE = "assets/news/noticias_recientes.txt";
 const char* CENTROS_FILE = "assets/news/centros_de_acopio.txt";
-const char* DATA_FILE = "recycling_data.dat"; 
 
 // --- Function Prototypes ---
 void init_colors();
-void draw_rounded_box(int y1, int x1, int y2, int x2);
+void ui_layout();
+void present();
+int read_key();
+int read_live_key();
+int menu_handle_key(Menu *menu, int key);
+void draw_rounded_box(WINDOW *win, int y1, int x1, int y2, int x2);
 char* read_asset_file(const char* filename);
-
-// Data persistence functions
-void save_data();
-void load_data();
+const Asset* get_asset(const char* path);
+const Asset* get_wrapped_asset(const char* path, int width);
+bool asset_cache_poll();
+void asset_cache_free();
+void toggle_stats_overlay();
+int finish(int status);
 
 // Component-like render functions
-void render_navbar(const char* banner);
+void render_navbar();
 void render_footer();
-void render_main_menu(int highlight);
+void set_status(const char* text);
+void render_stats_overlay();
+void render_menu(Menu *menu);
+void render_info_menu();
 void render_login_view();
 void render_donation_form();
+void render_table_view(const char* title, const char* header, int width, const int *total, TableRowFormatter format_row, TableRefresh refresh, const char* empty_text);
 void render_user_list();
 void render_donation_list();
+void render_user_search();
+void render_user_history(int user);
+void render_my_donations();
 void render_info_view(const char* title, const char* content_file);
+void render_leaderboard();
+void render_statistics();
+void render_date_report();
+
+// --- Main Menu ---
+enum {
+    ITEM_LOGIN,
+    ITEM_DONATE,
+    ITEM_MY_DONATIONS,
+    ITEM_USERS,
+    ITEM_SEARCH,
+    ITEM_DONATIONS,
+    ITEM_LEADERBOARD,
+    ITEM_STATISTICS,
+    ITEM_DATE_REPORT,
+    ITEM_INFO,
+    ITEM_EXIT,
+    MAIN_MENU_ITEMS
+};
+
+const char *main_menu_items[MAIN_MENU_ITEMS] = {
+    "Iniciar Sesion",
+    "Registrar Donacion",
+    "Mis Donaciones",
+    "Listar Usuarios",
+    "Buscar Usuario",
+    "Listar Donaciones",
+    "Mejores Donadores",
+    "Estadisticas",
+    "Reporte por Fechas",
+    "Informacion sobre Reciclaje",
+    "Salir"
+};
+
+// "Iniciar Sesion" until someone logs in, "Registrar Donacion" and "Mis Donaciones" after.
+static bool main_item_visible(int item) {
+    bool logged_in = logged_in_user[0] != '\0';
+    if (item == ITEM_LOGIN) return !logged_in;
+    if (item == ITEM_DONATE || item == ITEM_MY_DONATIONS) return logged_in;
+    return true;
+}
 
 // --- Main Application ---
-int main() {
+int main(int argc, char *argv[]) {
+    // Leading options, in any order, before the command:
+    //   --stats[=archivo]  time from the very start and write the numbers as JSON on exit
+    //   --centro=N         the collection center this kiosk serves, numbered as in
+    //                      centros_de_acopio.txt; only its donations are counted at startup
+    //                      (see shards.c)
+    while (argc > 1) {
+        if (strncmp(argv[1], "--stats", 7) == 0 && (argv[1][7] == '\0' || argv[1][7] == '=')) {
+            stats_report = argv[1][7] == '=' ? argv[1] + 8 : "";
+            stats_enable(true);
+        } else if (strncmp(argv[1], "--centro=", 9) == 0) {
+            char *end;
+            long center = strtol(argv[1] + 9, &end, 10);
+            if (end == argv[1] + 9 || *end != '\0' || center < 1 || center >= MAX_CENTERS) {
+                fprintf(stderr, "Centro invalido: %s (debe ser de 1 a %d).\n", argv[1] + 9, MAX_CENTERS - 1);
+                return finish(2);
+            }
+            shards.loaded[shards.home] = false; // the last --centro wins
+            shards.home = (int)center;
+            shards.loaded[center] = true;
+            shards.all_loaded = false;
+        } else {
+            break;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    // Headless commands never initialize curses, so they can run from cron
+    if (argc == 4 && strcmp(argv[1], "--convert") == 0) {
+        return finish(convert_data_file(argv[2], argv[3]));
+    } else if (argc == 3 && strcmp(argv[1], "import") == 0) {
+        return finish(run_import(argv[2]));
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "export") == 0) {
+        return finish(run_export(argc == 3 ? argv[2] : NULL));
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "serve") == 0) {
+        return finish(run_server(argc == 3 ? argv[2] : SERVER_SOCKET_FILE));
+    } else if (argc > 1) {
+        fprintf(stderr, "uso: %s [--stats[=archivo.json]] [--centro=N] [--convert <origen> <destino> | import <archivo.csv> | export [archivo.csv] | serve [socket]]\n", argv[0]);
+        return 2;
+    }
+
+    // Load database before touching the terminal so errors stay readable
+    if (!load_data()) {
+        fprintf(stderr, "No se pudo leer %s: archivo danado o de otra version.\n", DATA_FILE);
+        return finish(1);
+    }
+    persist_start(); // fsyncs and checkpoints happen off the UI thread from here on
+
     // Initialization
     setlocale(LC_ALL, "");
     initscr();
     cbreak();
     noecho();
     curs_set(0);
-    keypad(stdscr, TRUE);
     mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
     start_color();
     init_colors();
+    ui_layout();
 
-    // Load database 
-    load_data();
-    
-    char* banner_text = read_asset_file(BANNER_FILE);
-
-    int choice = -1;
-    int highlight = 0;
-    int main_menu_items = 6;
+    Menu main_menu = { "Menu Principal", main_menu_items, MAIN_MENU_ITEMS, 0, main_item_visible };
     bool running = true;
-    int current_view = 0; // 0: Main Menu, 1: Login, 2: Donation Form, etc.
 
     while (running) {
-        clear();
-        bkgd(COLOR_PAIR(COLOR_PAIR_DEFAULT));
-        
-        render_navbar(banner_text);
-
-        switch (current_view) {
-            case 0: // Main Menu
-                render_main_menu(highlight);
-                break;
-            case 1: // Login View
-                render_login_view();
-                current_view = 0; // Return to menu after
-                break;
-            case 2: // Register Donation
-                if (strlen(logged_in_user) > 0) {
-                    render_donation_form();
-                } else {
-                    mvprintw(LINES / 2, (COLS - 28) / 2, "Debes iniciar sesion primero.");
-                    getch();
-                }
-                current_view = 0;
-                break;
-            case 3: // List Users
-                render_user_list();
-                current_view = 0;
-                break;
-            case 4: // List Donations
-                render_donation_list();
-                current_view = 0;
-                break;
-            case 5: // Info: Como Reciclar
-                render_info_view("Como Reciclar", COMO_RECICLAR_FILE);
-                current_view = 0;
-                break;
-            case 6: // Info: Noticias
-                render_info_view("Noticias Recientes", NOTICIAS_FILE);
-                current_view = 0;
-                break;
-            case 7: // Info: Centros
-                render_info_view("Centros de Acopio", CENTROS_FILE);
-                current_view = 0;
-                break;
+        render_menu(&main_menu);
+        int key = read_key();
+        if (key == 'p') { // not on the menu: performance overlay for whoever is diagnosing a kiosk
+            toggle_stats_overlay();
+            continue;
         }
-        
-        render_footer();
-        refresh();
-
-        if (current_view == 0) { // Only handle menu navigation if in main menu
-            choice = getch();
-            switch (choice) {
-                case KEY_UP:
-                    highlight = (highlight == 0) ? main_menu_items - 1 : highlight - 1;
-                    break;
-                case KEY_DOWN:
-                    highlight = (highlight == main_menu_items - 1) ? 0 : highlight + 1;
-                    break;
-                case 10: // Enter key
-                    if (highlight == 0) { // Iniciar Sesion
-                         current_view = 1;
-                    } else if (highlight == 1) { // Registrar Donacion
-                        current_view = 2;
-                    } else if (highlight == 2) { // Listar Usuarios
-                        current_view = 3;
-                    } else if (highlight == 3) { // Listar Donaciones
-                        current_view = 4;
-                    } else if (highlight == 4) { // Informacion
-                        int info_highlight = 0;
-                        int info_items = 3;
-                        bool in_info_menu = true;
-                        while(in_info_menu) {
-                            clear();
-                            render_navbar(banner_text);
-                            mvprintw(8, (COLS - 25) / 2, "Informacion sobre Reciclaje");
-                            const char *info_options[] = {"Como reciclar", "Noticias recientes", "Centros de residuos solidos"};
-                            for(int i = 0; i < info_items; i++) {
-                                if(i == info_highlight) attron(COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
-                                mvprintw(10 + i * 2, (COLS - strlen(info_options[i])) / 2, info_options[i]);
-                                if(i == info_highlight) attroff(COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
-                            }
-                            render_footer();
-                            refresh();
-                            int info_choice = getch();
-                            switch(info_choice) {
-                                case KEY_UP:
-                                    info_highlight = (info_highlight == 0) ? info_items - 1 : info_highlight - 1;
-                                    break;
-                                case KEY_DOWN:
-                                    info_highlight = (info_highlight == info_items - 1) ? 0 : info_highlight + 1;
-                                    break;
-                                case 10:
-                                    if(info_highlight == 0) current_view = 5;
-                                    if(info_highlight == 1) current_view = 6;
-                                    if(info_highlight == 2) current_view = 7;
-                                    in_info_menu = false;
-                                    break;
-                                case 'q':
-                                case 27: // ESC
-                                    in_info_menu = false;
-                                    current_view = 0;
-                                    break;
-                            }
-                        }
-                    } else if (highlight == 5) { // Salir
-                        running = false;
-                    }
-                    break;
-                case 'q':
-                case 27: // ESC key
-                    running = false;
-                    break;
-            }
+
+        switch (menu_handle_key(&main_menu, key)) {
+            case ITEM_LOGIN:        render_login_view(); break;
+            case ITEM_DONATE:       render_donation_form(); break;
+            case ITEM_MY_DONATIONS: render_my_donations(); break;
+            case ITEM_USERS:        render_user_list(); break;
+            case ITEM_SEARCH:       render_user_search(); break;
+            case ITEM_DONATIONS:    render_donation_list(); break;
+            case ITEM_LEADERBOARD:  render_leaderboard(); break;
+            case ITEM_STATISTICS:   render_statistics(); break;
+            case ITEM_DATE_REPORT:  render_date_report(); break;
+            case ITEM_INFO:         render_info_menu(); break;
+            case ITEM_EXIT:
+            case MENU_BACK:
+                running = false;
+                break;
         }
     }
 
-    save_data();
-    free(banner_text);
+    persist_stop(); // waits for pending writes and the final checkpoint
+    journal_close();
+    asset_cache_free();
+    free_store();
     endwin();
-    return 0;
+    return finish(0);
 }
 
-// --- Database ---
-void save_data() {
-    FILE *file = fopen(DATA_FILE, "w");
-    if (file == NULL) {
-        return;
+// --- Color Initialization ---
+void init_colors() {
+    init_pair(COLOR_PAIR_DEFAULT, COLOR_CYAN, COLOR_BLACK);
+    init_pair(COLOR_PAIR_TITLE, COLOR_YELLOW, COLOR_BLACK);
+    init_pair(COLOR_PAIR_BUTTON_NORMAL, COLOR_WHITE, COLOR_BLACK);
+    init_pair(COLOR_PAIR_BUTTON_HIGHLIGHT, COLOR_BLACK, COLOR_CYAN);
+    init_pair(COLOR_PAIR_INPUT, COLOR_BLACK, COLOR_WHITE);
+    init_pair(COLOR_PAIR_BORDER, COLOR_WHITE, COLOR_BLACK);
+}
+
+// --- Instrumentation ---
+// A frame is one trip through the UI: from the key (or store change) that woke us up to the
+// present() that puts the result on screen. Each frame is charged to "frame" and to the
+// view on screen; interactive render_* functions make their timer current with view_enter
+// and hand the caller's back with view_leave. Nothing is timed while stats are off.
+static StatTimer frame_timer = STAT_TIMER("frame");
+static StatTimer *view_timer = NULL;
+static uint64_t frame_start = 0;
+
+static void frame_begin() {
+    frame_start = stats_begin();
+}
+
+static void frame_end() {
+    if (frame_start == 0) return;
+    uint64_t elapsed = stats_clock() - frame_start;
+    stats_record(&frame_timer, elapsed, 0);
+    if (view_timer != NULL) stats_record(view_timer, elapsed, 0);
+    frame_start = 0;
+}
+
+static StatTimer* view_enter(StatTimer *timer) {
+    StatTimer *outer = view_timer;
+    view_timer = timer;
+    return outer;
+}
+
+static void view_leave(StatTimer *outer) {
+    view_timer = outer;
+}
+
+// Grows with the number of timers in render_stats_overlay.
+static void stats_overlay_layout() {
+    if (screen.stats != NULL) delwin(screen.stats);
+    int width = COLS < STATS_OVERLAY_WIDTH ? COLS : STATS_OVERLAY_WIDTH;
+    screen.stats = newwin(4, width, NAVBAR_HEIGHT, COLS - width);
+    wbkgd(screen.stats, COLOR_PAIR(COLOR_PAIR_DEFAULT));
+    leaveok(screen.stats, TRUE); // the cursor stays in the text field being edited
+}
+
+// Shows or hides the overlay. Showing it turns collection on; hiding it turns it off again
+// unless --stats wants a report at the end.
+void toggle_stats_overlay() {
+    if (screen.stats == NULL) {
+        stats_enable(true);
+        stats_overlay_layout();
+    } else {
+        delwin(screen.stats);
+        screen.stats = NULL;
+        stats_enable(stats_report != NULL);
+        touchwin(screen.content);
     }
+}
 
-    for (int i = 0; i < user_count; i++) {
-        fprintf(file, "U|%s|%s\n", users[i].control_number, users[i].name);
+// Writes the --stats report, if one was asked for, and passes the exit status through.
+int finish(int status) {
+    if (stats_report == NULL) return status;
+    FILE *file = stats_report[0] != '\0' ? fopen(stats_report, "w") : stderr;
+    if (file == NULL) {
+        fprintf(stderr, "No se pudo escribir %s.\n", stats_report);
+        return status;
     }
+    stats_write_json(file);
+    if (file != stderr) fclose(file);
+    return status;
+}
 
-    for (int i = 0; i < donation_count; i++) {
-        fprintf(file, "D|%s|%d|%d|%d\n", donations[i].user_control_number, donations[i].paper, donations[i].plastic, donations[i].aluminum);
+// --- Screen Management ---
+// Creates the navbar/content/footer windows, or fits them to a resized terminal. Resized
+// windows keep their contents, so the next doupdate() only sends what the views change.
+void ui_layout() {
+    int content_height = LINES - NAVBAR_HEIGHT - FOOTER_HEIGHT;
+    if (content_height < 1) content_height = 1;
+    if (screen.navbar == NULL) {
+        screen.navbar = newwin(NAVBAR_HEIGHT, COLS, 0, 0);
+        screen.content = newwin(content_height, COLS, NAVBAR_HEIGHT, 0);
+        screen.footer = newwin(FOOTER_HEIGHT, COLS, NAVBAR_HEIGHT + content_height, 0);
+        wbkgd(screen.navbar, COLOR_PAIR(COLOR_PAIR_DEFAULT));
+        wbkgd(screen.content, COLOR_PAIR(COLOR_PAIR_DEFAULT));
+        wbkgd(screen.footer, COLOR_PAIR(COLOR_PAIR_DEFAULT));
+        keypad(screen.content, TRUE);
+        wtimeout(screen.content, 0); // never block in wgetch, wait_event sleeps in poll()
+    } else {
+        wresize(screen.navbar, NAVBAR_HEIGHT, COLS);
+        wresize(screen.content, content_height, COLS);
+        wresize(screen.footer, FOOTER_HEIGHT, COLS);
+        mvwin(screen.footer, NAVBAR_HEIGHT + content_height, 0);
     }
+    if (screen.stats != NULL) stats_overlay_layout();
+    screen.navbar_dirty = screen.footer_dirty = true;
+}
 
-    fclose(file);
+// Queues whatever changed and sends it to the terminal in a single doupdate().
+void present() {
+    render_navbar();
+    render_footer();
+    wnoutrefresh(screen.content);
+    if (screen.stats != NULL) render_stats_overlay(); // last, so it stays on top
+    doupdate();
+    frame_end();
 }
 
-void load_data() {
-    FILE *file = fopen(DATA_FILE, "r");
-    if (file == NULL) {
-        return;
+// --- Idle Work ---
+// Done ahead of time while nobody is typing: make journaled records durable (only without
+// the writer thread) and build what the reports and the search view would otherwise build
+// on first use.
+
+static bool idle_sync_journal() {
+    journal_sync();
+    return true;
+}
+
+// Not while other centers are unloaded: the columns would fault in their whole sections.
+static bool idle_build_columns() {
+    return !shards.all_loaded || columns_build_step(IDLE_COLUMN_ROWS);
+}
+
+// Same for the cold tier's quantity tables: they decode every block.
+static bool idle_build_cold_tables() {
+    return !shards.all_loaded || cold_tables_step(IDLE_COLD_BLOCKS);
+}
+
+static const IdleTask idle_tasks[] = { idle_sync_journal, idle_build_columns, idle_build_cold_tables, search_build_step };
+
+static uint64_t monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Runs task steps for up to IDLE_SLICE_US. Returns true once every task is done.
+static bool run_idle_work() {
+    static StatTimer timer = STAT_TIMER("idle_work");
+    uint64_t start = stats_begin();
+    uint64_t deadline = monotonic_us() + IDLE_SLICE_US;
+    bool done = true;
+    for (size_t i = 0; i < sizeof(idle_tasks) / sizeof(idle_tasks[0]) && done; i++) {
+        while (!(done = idle_tasks[i]()) && monotonic_us() < deadline) {}
     }
+    stats_end(&timer, start, 0);
+    return done;
+}
+
+// --- Event Loop ---
+// Every wait in the UI goes through wait_event. It flushes the frame, then sleeps in poll()
+// on the terminal, the inotify descriptor and the writer thread's wake-up pipe, at most
+// until the next check for other kiosks' inserts. Meanwhile it runs the writer's
+// acknowledgements, reloads changed assets and does idle work in short slices. It returns
+// the next key, or one of the events in wanted (EVENT_*) as a pseudo key. A terminal resize
+// refits the windows and comes back as KEY_RESIZE so the caller can redraw its content.
+static int wait_event(int wanted) {
+    static uint64_t next_store_poll = 0;
+    static uint64_t last_key = 0;
+    static bool idle_done = false; // nothing left since the last key or store change
+
+    present();
+    int key;
+    while ((key = wgetch(screen.content)) == ERR) {
+        persist_poll();
+        if (asset_cache_poll()) {
+            screen.navbar_dirty = true; // the logo or banner may be among them
+            if (wanted & EVENT_ASSETS) {
+                key = KEY_ASSETS_CHANGED;
+                break;
+            }
+        }
 
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        // Remove this angly whitespace
-        line[strcspn(line, "\n")] = 0;
+        uint64_t now = monotonic_us() / 1000;
+        if (now >= next_store_poll) {
+            next_store_poll = now + STORE_POLL_MS;
+            bool changed = store_refresh();
+            if (changed) idle_done = false;
+            if (changed && (wanted & EVENT_STORE)) {
+                key = KEY_STORE_CHANGED;
+                break;
+            }
+            if (screen.stats != NULL) present(); // the overlay shows live numbers
+        }
+        if (screen.footer_dirty || screen.navbar_dirty) present();
 
-        if (line[0] == 'U' && user_count < MAX_USERS) {
-            sscanf(line, "U|%[^|]|%[^\n]", users[user_count].control_number, users[user_count].name);
-            user_count++;
-        } else if (line[0] == 'D' && donation_count < MAX_DONATIONS) {
-            sscanf(line, "D|%[^|]|%d|%d|%d", donations[donation_count].user_control_number, &donations[donation_count].paper, &donations[donation_count].plastic, &donations[donation_count].aluminum);
-            donation_count++;
+        int timeout = (int)(next_store_poll - now);
+        if (!idle_done) {
+            if (now >= last_key + IDLE_DELAY_MS) {
+                idle_done = run_idle_work();
+                continue; // look for input between slices
+            }
+            if (last_key + IDLE_DELAY_MS - now < (uint64_t)timeout) timeout = (int)(last_key + IDLE_DELAY_MS - now);
         }
+
+        struct pollfd fds[3] = {
+            { STDIN_FILENO, POLLIN, 0 },
+            { assets.notify_fd, POLLIN, 0 },   // poll() skips negative descriptors
+            { persist_event_fd(), POLLIN, 0 },
+        };
+        poll(fds, 3, timeout); // a signal (SIGWINCH) ends it early too
     }
 
-    fclose(file);
+    if (key != KEY_STORE_CHANGED && key != KEY_ASSETS_CHANGED) {
+        last_key = monotonic_us() / 1000;
+        idle_done = false; // the key may have added records or dropped a build
+    }
+    if (key == KEY_RESIZE) ui_layout();
+    frame_begin();
+    return key;
 }
 
+int read_key() {
+    return wait_event(0);
+}
 
-// --- Color Initialization ---
-void init_colors() {
-    init_pair(COLOR_PAIR_DEFAULT, COLOR_CYAN, COLOR_BLACK);
-    init_pair(COLOR_PAIR_TITLE, COLOR_YELLOW, COLOR_BLACK);
-    init_pair(COLOR_PAIR_BUTTON_NORMAL, COLOR_WHITE, COLOR_BLACK);
-    init_pair(COLOR_PAIR_BUTTON_HIGHLIGHT, COLOR_BLACK, COLOR_CYAN);
-    init_pair(COLOR_PAIR_INPUT, COLOR_BLACK, COLOR_WHITE);
-    init_pair(COLOR_PAIR_BORDER, COLOR_WHITE, COLOR_BLACK);
+// For views that show store contents and redraw on any key they don't handle.
+int read_live_key() {
+    return wait_event(EVENT_STORE);
+}
+
+// Single-line text input on top of the event loop, so the screen keeps updating while
+// someone types. Enter accepts (true), Esc cancels (false); backspace drops a whole UTF-8
+// character.
+static bool read_field(WINDOW *win, int y, int x, int width, char *buffer, size_t size) {
+    size_t length = 0;
+    buffer[0] = '\0';
+    curs_set(1);
+    while (true) {
+        int cells = 0; // UTF-8 continuation bytes take no cell
+        for (size_t i = 0; i < length; i++) cells += ((unsigned char)buffer[i] & 0xC0) != 0x80;
+        wattron(win, COLOR_PAIR(COLOR_PAIR_INPUT));
+        mvwprintw(win, y, x, "%-*s", width + (int)length - cells, buffer);
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_INPUT));
+        wmove(win, y, x + cells);
+
+        int key = read_key();
+        if (key == 10 || key == KEY_ENTER || key == 27) {
+            curs_set(0);
+            return key != 27;
+        }
+        if (key == KEY_BACKSPACE || key == 127 || key == 8) {
+            while (length > 0 && ((unsigned char)buffer[--length] & 0xC0) == 0x80) {}
+            buffer[length] = '\0';
+        } else if (key >= 32 && key < 256 && length + 1 < size && (cells < width || (key & 0xC0) == 0x80)) {
+            buffer[length++] = (char)key;
+            buffer[length] = '\0';
+        }
+    }
 }
 
 // --- UI Drawing Utilities ---
-void draw_rounded_box(int y1, int x1, int y2, int x2) {
-    attron(COLOR_PAIR(COLOR_PAIR_BORDER));
-    mvaddch(y1, x1, ACS_ULCORNER);
-    mvaddch(y1, x2, ACS_URCORNER);
-    mvaddch(y2, x1, ACS_LLCORNER);
-    mvaddch(y2, x2, ACS_LRCORNER);
-    mvhline(y1, x1 + 1, ACS_HLINE, x2 - x1 - 1);
-    mvhline(y2, x1 + 1, ACS_HLINE, x2 - x1 - 1);
-    mvvline(y1 + 1, x1, ACS_VLINE, y2 - y1 - 1);
-    mvvline(y1 + 1, x2, ACS_VLINE, y2 - y1 - 1);
-    attroff(COLOR_PAIR(COLOR_PAIR_BORDER));
+void draw_rounded_box(WINDOW *win, int y1, int x1, int y2, int x2) {
+    wattron(win, COLOR_PAIR(COLOR_PAIR_BORDER));
+    mvwaddch(win, y1, x1, ACS_ULCORNER);
+    mvwaddch(win, y1, x2, ACS_URCORNER);
+    mvwaddch(win, y2, x1, ACS_LLCORNER);
+    mvwaddch(win, y2, x2, ACS_LRCORNER);
+    mvwhline(win, y1, x1 + 1, ACS_HLINE, x2 - x1 - 1);
+    mvwhline(win, y2, x1 + 1, ACS_HLINE, x2 - x1 - 1);
+    mvwvline(win, y1 + 1, x1, ACS_VLINE, y2 - y1 - 1);
+    mvwvline(win, y1 + 1, x2, ACS_VLINE, y2 - y1 - 1);
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_BORDER));
 }
 
 char* read_asset_file(const char* filename) {
+    static StatTimer timer = STAT_TIMER("read_asset_file");
+    uint64_t start = stats_begin();
     FILE *file = fopen(filename, "r");
     if (!file) return strdup("Error: no, el archivo no existe.");
     fseek(file, 0, SEEK_END);
@@ -332,275 +645,1272 @@ char* read_asset_file(const char* filename) {
     fread(buffer, 1, length, file);
     buffer[length] = '\0';
     fclose(file);
+    stats_end(&timer, start, (uint64_t)length);
     return buffer;
 }
 
 
+// --- Asset Cache ---
+// Views ask for assets every frame; the files are read once and served from memory until
+// they change on disk. With inotify a change event triggers the stat check, otherwise every
+// cached file is re-stat'ed at most once per ASSET_RECHECK_SECONDS.
+
+static void asset_watch(Asset *asset) {
+    asset->watch = -1;
+#ifdef __linux__
+    if (assets.count == 0) {
+        assets.notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    if (assets.notify_fd < 0) return;
+
+    // watch the directory so editors that replace the file by rename are caught too
+    char dir[PATH_MAX] = ".";
+    const char *slash = strrchr(asset->path, '/');
+    if (slash != NULL) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - asset->path), asset->path);
+    asset->watch = inotify_add_watch(assets.notify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+#endif
+}
+
+static void asset_load(Asset *asset) {
+    struct stat st;
+    bool exists = stat(asset->path, &st) == 0;
+    asset->check = false;
+    if (asset->loaded && exists && st.st_size == asset->size
+        && st.st_mtim.tv_sec == asset->mtime.tv_sec && st.st_mtim.tv_nsec == asset->mtime.tv_nsec) {
+        return;
+    }
+
+    free(asset->text);
+    free(asset->lines);
+    asset->text = read_asset_file(asset->path);
+    asset->size = exists ? st.st_size : -1;
+    if (exists) asset->mtime = st.st_mtim;
+
+    // split in place; a trailing newline doesn't start another line
+    int count = 1;
+    for (char *c = asset->text; *c; c++) {
+        if (*c == '\n' && c[1] != '\0') count++;
+    }
+    asset->lines = malloc(count * sizeof(char*));
+    asset->line_count = 0;
+    char *line = asset->text;
+    while (asset->lines != NULL && *line) {
+        char *end = line + strcspn(line, "\n");
+        bool last = *end == '\0';
+        *end = '\0';
+        if (end > line && end[-1] == '\r') end[-1] = '\0';
+        asset->lines[asset->line_count++] = line;
+        if (last) break;
+        line = end + 1;
+    }
+    asset->loaded = true;
+    asset->version++;
+}
+
+static Asset* asset_lookup(const char* path) {
+    Asset *asset = NULL;
+    for (int i = 0; i < assets.count; i++) {
+        if (strcmp(assets.entries[i].path, path) == 0) {
+            asset = &assets.entries[i];
+            break;
+        }
+    }
+
+    if (asset == NULL) {
+        static Asset overflow; // cache full: degrade to re-reading this one file
+        if (assets.count == MAX_CACHED_ASSETS) {
+            if (overflow.path == NULL || strcmp(overflow.path, path) != 0) overflow.loaded = false;
+            overflow.path = path;
+            overflow.check = true;
+            overflow.watch = -1;
+            asset = &overflow;
+        } else {
+            asset = &assets.entries[assets.count];
+            memset(asset, 0, sizeof(*asset));
+            asset->path = path;
+            asset_watch(asset);
+            assets.count++;
+        }
+    }
+
+    if (!asset->loaded || asset->check) asset_load(asset);
+    return asset;
+}
+
+const Asset* get_asset(const char* path) {
+    return asset_lookup(path);
+}
+
+// Reloads cached assets that changed on disk; true if any did. Called by the event loop
+// between keys: cheap, never blocks.
+bool asset_cache_poll() {
+#ifdef __linux__
+    if (assets.notify_fd >= 0) {
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+        while ((length = read(assets.notify_fd, events, sizeof(events))) > 0) {
+            for (char *p = events; p < events + length; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+                int wd = ((struct inotify_event*)p)->wd;
+                for (int i = 0; i < assets.count; i++) {
+                    if (assets.entries[i].watch == wd) assets.entries[i].check = true;
+                }
+            }
+        }
+    }
+#endif
+
+    time_t now = time(NULL);
+    if (now - assets.last_check >= ASSET_RECHECK_SECONDS) {
+        assets.last_check = now;
+        for (int i = 0; i < assets.count; i++) {
+            if (assets.entries[i].watch < 0) assets.entries[i].check = true;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < assets.count; i++) {
+        Asset *asset = &assets.entries[i];
+        if (!asset->check) continue;
+        unsigned version = asset->version;
+        asset_load(asset);
+        changed |= asset->version != version;
+    }
+    return changed;
+}
+
+void asset_cache_free() {
+    for (int i = 0; i < assets.count; i++) {
+        free(assets.entries[i].text);
+        free(assets.entries[i].lines);
+        free(assets.entries[i].rows);
+    }
+    assets.count = 0;
+    if (assets.notify_fd >= 0) {
+        close(assets.notify_fd);
+        assets.notify_fd = -1;
+    }
+}
+
+
+// --- Text Layout ---
+// Wraps an asset's lines by display width, not bytes: accented letters and bullets take
+// one cell for several bytes. Lines break at the last space that fits, or mid-word when a
+// word is wider than the column. Empty lines are skipped, as the views always did.
+
+static bool asset_add_row(Asset *asset, const char *start, int length) {
+    if (asset->row_count == asset->row_capacity) {
+        int capacity = asset->row_capacity ? asset->row_capacity * 2 : 64;
+        TextRow *grown = realloc(asset->rows, capacity * sizeof(TextRow));
+        if (grown == NULL) return false;
+        asset->rows = grown;
+        asset->row_capacity = capacity;
+    }
+    asset->rows[asset->row_count++] = (TextRow){ start, length };
+    return true;
+}
+
+static void asset_wrap(Asset *asset, int width) {
+    static StatTimer timer = STAT_TIMER("wrap_asset");
+    uint64_t start = stats_begin();
+    uint64_t bytes = 0;
+    asset->row_count = 0;
+    bool ok = true;
+    for (int i = 0; i < asset->line_count && ok; i++) {
+        const char *line = asset->lines[i];
+        size_t length = strlen(line);
+        bytes += length;
+        if (length == 0) continue;
+
+        const char *row = line;       // start of the row being filled
+        const char *space = NULL;     // last space in it, where it would break
+        int cells = 0;
+        mbstate_t state;
+        memset(&state, 0, sizeof(state));
+        const char *c = line;
+        while (*c != '\0' && ok) {
+            wchar_t wide;
+            size_t size = mbrtowc(&wide, c, (size_t)(line + length - c), &state);
+            int cell = 1;
+            if (size == (size_t)-1 || size == (size_t)-2 || size == 0) {
+                size = 1; // not valid UTF-8: one byte, one cell
+                memset(&state, 0, sizeof(state));
+            } else {
+                cell = wcwidth(wide);
+                if (cell < 0) cell = 1;
+            }
+
+            if (cells + cell > width && c > row) {
+                const char *end = space != NULL && space > row ? space : c;
+                ok = asset_add_row(asset, row, (int)(end - row));
+                row = end;
+                while (*row == ' ') row++; // the break eats the spaces
+                space = NULL;
+                cells = 0;
+                for (const char *p = row; p < c; p++) cells += ((unsigned char)*p & 0xC0) != 0x80;
+                continue; // measure c again on the new row
+            }
+            if (*c == ' ') space = c;
+            cells += cell;
+            c += size;
+        }
+        if (ok && c > row) ok = asset_add_row(asset, row, (int)(c - row));
+    }
+    asset->wrap_width = width;
+    asset->wrap_version = asset->version;
+    stats_end(&timer, start, bytes);
+}
+
+// The asset with rows[] wrapped to width cells; reuses the last layout while neither the
+// file nor the width changed, so paging through it costs only the rows drawn.
+const Asset* get_wrapped_asset(const char* path, int width) {
+    Asset *asset = asset_lookup(path);
+    if (asset->rows == NULL || asset->wrap_width != width || asset->wrap_version != asset->version) {
+        asset_wrap(asset, width);
+    }
+    return asset;
+}
+
+
 // --- Component Renders ---
 
-void render_navbar(const char* banner) {
-    char* logo_text = read_asset_file(LOGO_FILE);
+// Redraws the navbar only if it was flagged or the logo/banner files were reloaded.
+void render_navbar() {
+    const Asset* logo = get_asset(LOGO_FILE);
+    const Asset* banner = get_asset(BANNER_FILE);
+    if (!screen.navbar_dirty && logo->version == screen.logo_version && banner->version == screen.banner_version) {
+        return;
+    }
+
+    static StatTimer timer = STAT_TIMER("render_navbar");
+    uint64_t start = stats_begin();
+    WINDOW *win = screen.navbar;
     int start_y = 1;
     int start_x = 2;
+    werase(win);
     
-    // Buffer temporal para strtok
-    char* logo_buffer = strdup(logo_text);
-    char* line = strtok(logo_buffer, "\n");
-    while(line != NULL) {
-        mvprintw(start_y++, start_x, "%s", line);
-        line = strtok(NULL, "\n");
+    for (int i = 0; i < logo->line_count; i++) {
+        if (logo->lines[i][0] == '\0') continue;
+        mvwprintw(win, start_y++, start_x, "%s", logo->lines[i]);
     }
-    free(logo_buffer);
-    free(logo_text);
-
 
     // Print banner
-    attron(COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
-    mvprintw(3, start_x + 25, banner);
-    attroff(COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+    wattron(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+    if (banner->line_count > 0) mvwprintw(win, 3, start_x + 25, "%s", banner->lines[0]);
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
 
     // "Inicio" button
     const char* inicio_btn = " Inicio ";
     int btn_x = COLS - strlen(inicio_btn) - 4;
-    draw_rounded_box(2, btn_x, 4, btn_x + strlen(inicio_btn) + 1);
-    mvprintw(3, btn_x + 1, inicio_btn);
+    draw_rounded_box(win, 2, btn_x, 4, btn_x + strlen(inicio_btn) + 1);
+    mvwprintw(win, 3, btn_x + 1, "%s", inicio_btn);
     
     // Top border line
-    mvhline(6, 0, ACS_HLINE, COLS);
+    mvwhline(win, 6, 0, ACS_HLINE, COLS);
+
+    wnoutrefresh(win);
+    screen.navbar_dirty = false;
+    screen.logo_version = logo->version;
+    screen.banner_version = banner->version;
+    stats_end(&timer, start, 0);
+}
+
+void set_status(const char* text) {
+    snprintf(screen.status, sizeof(screen.status), "%s", text);
+    screen.footer_dirty = true;
+}
+
+// Acknowledgement from the writer thread: the donation is on disk.
+static void donation_saved(void *context) {
+    (void)context;
+    set_status("Donacion guardada");
 }
 
 void render_footer() {
+    if (!screen.footer_dirty) return;
+    static StatTimer timer = STAT_TIMER("render_footer");
+    uint64_t start = stats_begin();
+
     const char* footer_text = "3 lil-putos incorporated 2025. BSD Licence";
-    int y = LINES - 2;
     int x = (COLS - strlen(footer_text)) / 2;
-    mvhline(y - 1, 0, ACS_HLINE, COLS);
-    mvprintw(y, x, footer_text);
-}
-
-
-void render_main_menu(int highlight) {
-    char* menu_title = "Menu Principal";
-    mvprintw(8, (COLS - strlen(menu_title)) / 2, menu_title);
-
-    const char *menu_items[] = {
-        "Iniciar Sesion",
-        "Registrar Donacion",
-        "Listar Usuarios",
-        "Listar Donaciones",
-        "Informacion sobre Reciclaje",
-        "Salir"
-    };
-    int num_items = sizeof(menu_items) / sizeof(char*);
-
-    for (int i = 0; i < num_items; ++i) {
-        // Hide "Iniciar Sesion" if already logged in
-        if (i == 0 && strlen(logged_in_user) > 0) continue;
-        // Hide "Registrar Donacion" if not logged in
-        if (i == 1 && strlen(logged_in_user) == 0) continue;
-        
-        int y = 10 + i * 2;
-        int x = (COLS - strlen(menu_items[i])) / 2;
-        
-        if (highlight == i) {
-            attron(COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+    werase(screen.footer);
+    mvwhline(screen.footer, 0, 0, ACS_HLINE, COLS);
+    mvwprintw(screen.footer, 1, x, "%s", footer_text);
+    if (screen.status[0] != '\0') {
+        mvwprintw(screen.footer, 1, COLS - (int)strlen(screen.status) - 2, "%s", screen.status);
+    }
+    wnoutrefresh(screen.footer);
+    screen.footer_dirty = false;
+    stats_end(&timer, start, 0);
+}
+
+static void format_duration(uint64_t ns, char *buffer, size_t size) {
+    if (ns < 1000) {
+        snprintf(buffer, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(buffer, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buffer, size, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buffer, size, "%.2fs", ns / 1e9);
+    }
+}
+
+static void format_bytes(uint64_t bytes, char *buffer, size_t size) {
+    if (bytes == 0) {
+        snprintf(buffer, size, "-");
+    } else if (bytes < 1024) {
+        snprintf(buffer, size, "%llu", (unsigned long long)bytes);
+    } else if (bytes < 1024 * 1024) {
+        snprintf(buffer, size, "%.1fK", bytes / 1024.0);
+    } else {
+        snprintf(buffer, size, "%.1fM", bytes / (1024.0 * 1024.0));
+    }
+}
+
+// Live numbers of every timer that has run: count, p50/p99/max latency and bytes moved.
+void render_stats_overlay() {
+    WINDOW *win = screen.stats;
+    int rows = 0;
+    for (const StatTimer *timer = stats_first(); timer != NULL; timer = stats_next(timer)) rows++;
+    int height = rows + 4;
+    if (height > getmaxy(screen.content)) height = getmaxy(screen.content);
+    if (height != getmaxy(win)) wresize(win, height, getmaxx(win));
+
+    int width = getmaxx(win);
+    werase(win);
+    draw_rounded_box(win, 0, 0, height - 1, width - 1);
+    wattron(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+    mvwprintw(win, 1, 2, "%-20s %7s %7s %7s %7s %7s", "Rendimiento", "n", "p50", "p99", "max", "bytes");
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+
+    int y = 2;
+    for (const StatTimer *timer = stats_first(); timer != NULL && y < height - 2; timer = stats_next(timer)) {
+        char p50[16], p99[16], max[16], bytes[16];
+        format_duration(stats_percentile(timer, 0.50), p50, sizeof(p50));
+        format_duration(stats_percentile(timer, 0.99), p99, sizeof(p99));
+        format_duration(timer->max_ns, max, sizeof(max));
+        format_bytes(timer->bytes, bytes, sizeof(bytes));
+        mvwprintw(win, y++, 2, "%-20.20s %7llu %7s %7s %7s %7s", timer->name,
+                  (unsigned long long)timer->count, p50, p99, max, bytes);
+    }
+    mvwprintw(win, height - 2, 2, "p: ocultar");
+    wnoutrefresh(win);
+}
+
+
+// --- Menus ---
+static bool menu_item_visible(const Menu *menu, int item) {
+    return menu->visible == NULL || menu->visible(item);
+}
+
+// Moves the highlight to the next visible item in direction step, wrapping around.
+static void menu_move(Menu *menu, int step) {
+    for (int i = 0; i < menu->count; i++) {
+        menu->highlight = (menu->highlight + step + menu->count) % menu->count;
+        if (menu_item_visible(menu, menu->highlight)) return;
+    }
+}
+
+// Keeps the highlight off hidden items, e.g. "Iniciar Sesion" right after logging in.
+static void menu_clamp(Menu *menu) {
+    if (!menu_item_visible(menu, menu->highlight)) menu_move(menu, 1);
+}
+
+void render_menu(Menu *menu) {
+    static StatTimer timer = STAT_TIMER("render_menu");
+    uint64_t start = stats_begin();
+    WINDOW *win = screen.content;
+    werase(win);
+    menu_clamp(menu);
+
+    mvwprintw(win, 1, (COLS - strlen(menu->title)) / 2, "%s", menu->title);
+    int shown = 0;
+    for (int i = 0; i < menu->count; ++i) shown += menu_item_visible(menu, i);
+    int spacing = getmaxy(win) >= 3 + shown * 2 ? 2 : 1; // squeeze on short terminals
+
+    int row = 0; // hidden items leave no gap, the arrows skip them too (see menu_move)
+    for (int i = 0; i < menu->count; ++i) {
+        if (!menu_item_visible(menu, i)) continue;
+
+        int y = 3 + row++ * spacing;
+        int x = (COLS - strlen(menu->items[i])) / 2;
+
+        if (menu->highlight == i) {
+            wattron(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
         } else {
-            attron(COLOR_PAIR(COLOR_PAIR_BUTTON_NORMAL));
+            wattron(win, COLOR_PAIR(COLOR_PAIR_BUTTON_NORMAL));
         }
-        mvprintw(y, x, " %s ", menu_items[i]);
-        attroff(COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
-        attroff(COLOR_PAIR(COLOR_PAIR_BUTTON_NORMAL));
+        mvwprintw(win, y, x, " %s ", menu->items[i]);
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_BUTTON_NORMAL));
+    }
+    stats_end(&timer, start, 0);
+}
+
+// Arrows move the highlight; Enter returns the highlighted item, q/Esc MENU_BACK and any
+// other key MENU_NONE.
+int menu_handle_key(Menu *menu, int key) {
+    menu_clamp(menu);
+    switch (key) {
+        case KEY_UP:
+            menu_move(menu, -1);
+            return MENU_NONE;
+        case KEY_DOWN:
+            menu_move(menu, 1);
+            return MENU_NONE;
+        case 10:
+        case KEY_ENTER:
+            return menu->highlight;
+        case 'q':
+        case 27: // ESC
+            return MENU_BACK;
+    }
+    return MENU_NONE;
+}
+
+// Submenu of the info pages: opens the chosen one, then goes back to the main menu.
+void render_info_menu() {
+    static StatTimer timer = STAT_TIMER("render_info_menu");
+    StatTimer *outer = view_enter(&timer);
+    static const char *items[] = { "Como reciclar", "Noticias recientes", "Centros de residuos solidos" };
+    static const char *titles[] = { "Como Reciclar", "Noticias Recientes", "Centros de Acopio" };
+    const char *files[] = { COMO_RECICLAR_FILE, NOTICIAS_FILE, CENTROS_FILE };
+    Menu menu = { "Informacion sobre Reciclaje", items, 3, 0, NULL };
+
+    int chosen = MENU_NONE;
+    while (chosen == MENU_NONE) {
+        render_menu(&menu);
+        chosen = menu_handle_key(&menu, read_key());
     }
+    if (chosen >= 0) render_info_view(titles[chosen], files[chosen]);
+    view_leave(outer);
 }
 
 void render_login_view() {
-    clear();
-    char* banner_text = read_asset_file(BANNER_FILE);
-    render_navbar(banner_text);
-    free(banner_text);
+    static StatTimer timer = STAT_TIMER("render_login_view");
+    StatTimer *outer = view_enter(&timer);
+    WINDOW *win = screen.content;
+    werase(win);
     
-    int form_y = LINES / 2 - 3;
+    int form_y = getmaxy(win) / 2 - 5;
     int form_x = (COLS - 50) / 2;
-    draw_rounded_box(form_y - 1, form_x - 2, form_y + 5, form_x + 52);
+    draw_rounded_box(win, form_y - 1, form_x - 2, form_y + 5, form_x + 52);
 
-    mvprintw(form_y, form_x, "Inicio de Sesion");
+    mvwprintw(win, form_y, form_x, "Inicio de Sesion");
 
     // Control Number field
-    mvprintw(form_y + 2, form_x, "Numero de Control: ");
-    attron(COLOR_PAIR(COLOR_PAIR_INPUT));
-    for(int i=0; i < MAX_CONTROL_NUMBER_LENGTH; i++) mvprintw(form_y + 2, form_x + 20 + i, " ");
-    attroff(COLOR_PAIR(COLOR_PAIR_INPUT));
+    mvwprintw(win, form_y + 2, form_x, "Numero de Control: ");
+    wattron(win, COLOR_PAIR(COLOR_PAIR_INPUT));
+    mvwprintw(win, form_y + 2, form_x + 20, "%*s", MAX_CONTROL_NUMBER_LENGTH, "");
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_INPUT));
     
     // Name field
-    mvprintw(form_y + 4, form_x, "Nombre: ");
-    attron(COLOR_PAIR(COLOR_PAIR_INPUT));
-    for(int i=0; i < MAX_NAME_LENGTH; i++) mvprintw(form_y + 4, form_x + 20 + i, " ");
-    attroff(COLOR_PAIR(COLOR_PAIR_INPUT));
-    
-    refresh();
+    mvwprintw(win, form_y + 4, form_x, "Nombre: ");
+    wattron(win, COLOR_PAIR(COLOR_PAIR_INPUT));
+    mvwprintw(win, form_y + 4, form_x + 20, "%*s", MAX_NAME_LENGTH, "");
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_INPUT));
 
     char control_num[MAX_CONTROL_NUMBER_LENGTH];
     char name[MAX_NAME_LENGTH];
 
-    echo();
-    curs_set(1);
-    
-    attron(COLOR_PAIR(COLOR_PAIR_INPUT));
-    mvwgetnstr(stdscr, form_y + 2, form_x + 20, control_num, MAX_CONTROL_NUMBER_LENGTH - 1);
-    mvwgetnstr(stdscr, form_y + 4, form_x + 20, name, MAX_NAME_LENGTH - 1);
-    attroff(COLOR_PAIR(COLOR_PAIR_INPUT));
-
-    noecho();
-    curs_set(0);
+    // Esc on either field goes back without logging in
+    if (!read_field(win, form_y + 2, form_x + 20, MAX_CONTROL_NUMBER_LENGTH, control_num, sizeof(control_num))
+        || !read_field(win, form_y + 4, form_x + 20, MAX_NAME_LENGTH, name, sizeof(name))) {
+        view_leave(outer);
+        return;
+    }
 
-    // Check if user exists, if not, register
-    bool user_found = false;
-    for (int i = 0; i < user_count; i++) {
-        if (strcmp(users[i].control_number, control_num) == 0) {
-            user_found = true;
-            break;
-        }
+    // Both fields end up in '|'-separated journal records, checked like import and the socket
+    if (!valid_text_field(control_num, MAX_CONTROL_NUMBER_LENGTH) || !valid_text_field(name, MAX_NAME_LENGTH)) {
+        mvwprintw(win, form_y + 7, form_x, "Numero de control o nombre invalido (vacio o con '|').");
+        read_key();
+        view_leave(outer);
+        return;
     }
 
-    if (!user_found && user_count < MAX_USERS) {
-        strcpy(users[user_count].control_number, control_num);
-        strcpy(users[user_count].name, name);
-        user_count++;
-        save_data(); // I must have followed her...
+    // Check if user exists, if not, register. Locked so another kiosk can't register the
+    // same control number in between.
+    store_lock();
+    bool registered = find_user(control_num) != NULL;
+    if (!registered) {
+        User *user = add_user(control_num, name);
+        if (user != NULL) journal_append_user(user); // I must have followed her...
+        registered = user != NULL;
     }
-    
+    store_unlock();
+    if (!registered) {
+        mvwprintw(win, form_y + 7, form_x, "No se pudo registrar al usuario (sin memoria).");
+        read_key();
+        view_leave(outer);
+        return;
+    }
+
     strcpy(logged_in_user, control_num);
 
-    mvprintw(form_y + 7, form_x, "Bienvenido, %s! Presiona una tecla para continuar.", name);
-    getch();
+    mvwprintw(win, form_y + 7, form_x, "Bienvenido, %s! Presiona una tecla para continuar.", name);
+    read_key();
+    view_leave(outer);
 }
 
 
 void render_donation_form() {
-    clear();
-    char* banner_text = read_asset_file(BANNER_FILE);
-    render_navbar(banner_text);
-    free(banner_text);
+    static StatTimer timer = STAT_TIMER("render_donation_form");
+    StatTimer *outer = view_enter(&timer);
+    WINDOW *win = screen.content;
+    werase(win);
 
-    int form_y = LINES / 2 - 4;
+    int form_y = getmaxy(win) / 2 - 6;
     int form_x = (COLS - 40) / 2;
-    draw_rounded_box(form_y - 1, form_x - 2, form_y + 8, form_x + 42);
+    draw_rounded_box(win, form_y - 1, form_x - 2, form_y + 8, form_x + 42);
 
-    mvprintw(form_y, form_x, "Registrar Donacion");
+    mvwprintw(win, form_y, form_x, "Registrar Donacion");
 
-    mvprintw(form_y + 2, form_x, "Papel (kg): ");
-    mvprintw(form_y + 4, form_x, "Plastico (kg): ");
-    mvprintw(form_y + 6, form_x, "Aluminio (kg): ");
+    mvwprintw(win, form_y + 2, form_x, "Papel (kg): ");
+    mvwprintw(win, form_y + 4, form_x, "Plastico (kg): ");
+    mvwprintw(win, form_y + 6, form_x, "Aluminio (kg): ");
 
-    refresh();
-    
     char paper_str[10], plastic_str[10], aluminum_str[10];
 
-    echo();
-    curs_set(1);
-    attron(COLOR_PAIR(COLOR_PAIR_INPUT));
-    mvwgetnstr(stdscr, form_y + 2, form_x + 15, paper_str, 9);
-    mvwgetnstr(stdscr, form_y + 4, form_x + 15, plastic_str, 9);
-    mvwgetnstr(stdscr, form_y + 6, form_x + 15, aluminum_str, 9);
-    attroff(COLOR_PAIR(COLOR_PAIR_INPUT));
-    noecho();
-    curs_set(0);
+    if (!read_field(win, form_y + 2, form_x + 15, 9, paper_str, sizeof(paper_str))
+        || !read_field(win, form_y + 4, form_x + 15, 9, plastic_str, sizeof(plastic_str))
+        || !read_field(win, form_y + 6, form_x + 15, 9, aluminum_str, sizeof(aluminum_str))) {
+        view_leave(outer);
+        return;
+    }
+
+    // an empty field means none of that material, anything else must be a whole number of kg
+    const char *fields[MATERIAL_COUNT] = { paper_str, plastic_str, aluminum_str };
+    int kg[MATERIAL_COUNT] = { 0 };
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        if (fields[m][0] != '\0' && !parse_quantity(fields[m], &kg[m])) {
+            mvwprintw(win, form_y + 9, form_x, "Cantidad invalida, no se registro la donacion.");
+            read_key();
+            view_leave(outer);
+            return;
+        }
+    }
 
-    if (donation_count < MAX_DONATIONS) {
-        strcpy(donations[donation_count].user_control_number, logged_in_user);
-        donations[donation_count].paper = atoi(paper_str);
-        donations[donation_count].plastic = atoi(plastic_str);
-        donations[donation_count].aluminum = atoi(aluminum_str);
-        donation_count++;
-        save_data(); // shi! I lost her...
-        mvprintw(form_y + 9, form_x, "Donacion registrada, Presiona una tecla.");
+    store_lock();
+    Donation *donation = add_donation(logged_in_user, kg[MATERIAL_PAPER], kg[MATERIAL_PLASTIC], kg[MATERIAL_ALUMINUM], time(NULL));
+    if (donation != NULL) journal_append_donation(donation); // shi! I lost her...
+    store_unlock();
+    if (donation != NULL) {
+        set_status("Guardando...");
+        persist_notify(donation_saved, NULL);
+        mvwprintw(win, form_y + 9, form_x, "Donacion registrada, Presiona una tecla.");
     } else {
-        mvprintw(form_y + 9, form_x, "Base de datos llena.");
+        mvwprintw(win, form_y + 9, form_x, "No se pudo registrar la donacion (sin memoria).");
     }
 
-    getch();
+    read_key();
+    view_leave(outer);
 }
 
-void render_user_list() {
-    clear();
-    char* banner_text = read_asset_file(BANNER_FILE);
-    render_navbar(banner_text);
-    free(banner_text);
-    
-    int list_y = 8;
-    int list_x = (COLS - 60) / 2;
-    draw_rounded_box(list_y - 1, list_x - 2, LINES - 4, list_x + 62);
-    mvprintw(list_y, list_x, "Usuarios Registrados");
-    mvprintw(list_y + 2, list_x, "No. Control         | Nombre");
-    mvhline(list_y + 3, list_x, '-', 50);
-
-    if (user_count == 0) {
-        mvprintw(list_y + 4, list_x, "No hay usuarios registrados.");
-    } else {
-        for (int i = 0; i < user_count; i++) {
-            mvprintw(list_y + 4 + i, list_x, "%-20s| %s", users[i].control_number, users[i].name);
+// --- Table Views ---
+// Scrollable tables that only format and draw the rows inside the visible window, so a
+// keystroke costs the same with a hundred records or ten million.
+
+// Prompts for a 1-based row number on the hint line. Returns the 0-based row or -1.
+static int prompt_row_number(WINDOW *win, int y, int x, int total) {
+    char input[12] = "";
+    wmove(win, y, x);
+    wclrtoeol(win);
+    mvwprintw(win, y, x, "Ir a la fila (1-%d): ", total);
+    if (!read_field(win, y, getcurx(win), sizeof(input) - 1, input, sizeof(input))) return -1;
+
+    char *end;
+    long row = strtol(input, &end, 10);
+    if (end == input || row < 1) return -1;
+    return row > total ? total - 1 : (int)row - 1;
+}
+
+static void list_view_clamp(ListView *view) {
+    if (view->selected >= view->total) view->selected = view->total - 1;
+    if (view->selected < 0) view->selected = 0;
+    if (view->selected < view->top) view->top = view->selected;
+    if (view->selected >= view->top + view->height) view->top = view->selected - view->height + 1;
+    if (view->top < 0) view->top = 0;
+}
+
+// Applies a navigation key. Returns false if the key isn't a navigation key.
+static bool list_view_handle_key(ListView *view, int key) {
+    switch (key) {
+        case KEY_UP:    view->selected--; break;
+        case KEY_DOWN:  view->selected++; break;
+        case KEY_PPAGE: view->selected -= view->height; view->top -= view->height; break;
+        case KEY_NPAGE: view->selected += view->height; view->top += view->height; break;
+        case KEY_HOME:  view->selected = 0; break;
+        case KEY_END:   view->selected = view->total - 1; break;
+        default: return false;
+    }
+    if (view->top > view->total - view->height) view->top = view->total - view->height;
+    list_view_clamp(view);
+    return true;
+}
+
+void render_table_view(const char* title, const char* header, int width, const int *total, TableRowFormatter format_row, TableRefresh refresh, const char* empty_text) {
+    WINDOW *win = screen.content;
+    ListView view = { 0, 0, 0, 1 };
+    char row[256];
+
+    while (true) {
+        int list_y = 1;
+        int list_x = (COLS - width) / 2;
+        int rows_y = list_y + 4;
+        int bottom_y = getmaxy(win) - 1;
+        int hint_y = bottom_y - 1;
+
+        view.total = *total; // re-read every frame, the table may have grown
+        view.height = hint_y - rows_y > 1 ? hint_y - rows_y : 1;
+        list_view_clamp(&view);
+
+        werase(win); // only the cells that differ from the last frame reach the terminal
+        draw_rounded_box(win, list_y - 1, list_x - 2, bottom_y, list_x + width + 2);
+        mvwprintw(win, list_y, list_x, "%s", title);
+        mvwprintw(win, list_y + 2, list_x, "%s", header);
+        mvwhline(win, list_y + 3, list_x, '-', width);
+
+        if (view.total == 0) {
+            mvwprintw(win, rows_y, list_x, "%s", empty_text);
+        } else {
+            int last = view.top + view.height < view.total ? view.top + view.height : view.total;
+            for (int i = view.top; i < last; i++) {
+                format_row(i, row, sizeof(row));
+                if (i == view.selected) wattron(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+                mvwprintw(win, rows_y + i - view.top, list_x, "%-*.*s", width, width, row);
+                if (i == view.selected) wattroff(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+            }
+            char position[48];
+            int length = snprintf(position, sizeof(position), "%d-%d de %d", view.top + 1, last, view.total);
+            mvwprintw(win, list_y, list_x + width - length, "%s", position);
+        }
+
+        mvwprintw(win, hint_y, list_x, "RePag/AvPag, Inicio/Fin, g: ir a fila, q: volver");
+
+        int key = read_live_key();
+        if (key == KEY_STORE_CHANGED && refresh != NULL) refresh();
+        if (key == 'q' || key == 27 || key == 10) break;
+        if (list_view_handle_key(&view, key)) continue;
+        if (key == 'g' && view.total > 0) {
+            int target = prompt_row_number(win, hint_y, list_x, view.total);
+            if (target >= 0) {
+                view.selected = target;
+                view.top = target - view.height / 2;
+                if (view.top > view.total - view.height) view.top = view.total - view.height;
+                list_view_clamp(&view);
+            }
         }
     }
-    
-    mvprintw(LINES - 5, list_x, "->.");
-    getch();
+}
+
+static void format_user_row(int row, char *buffer, size_t size) {
+    User *user = user_at(row);
+    snprintf(buffer, size, "%-20s| %s", user->control_number, user->name);
+}
+
+// Header matching format_donation_row.
+static const char *donation_header = "No. Control          | Papel | Plastico | Aluminio | Fecha";
+
+static void format_donation_row(int row, char *buffer, size_t size) {
+    const Donation *donation = donation_at(row);
+    char date[20] = "-"; // undated, recorded before donations kept the time
+    time_t t = (time_t)donation->timestamp;
+    struct tm local;
+    if (donation->timestamp > 0 && localtime_r(&t, &local) != NULL) {
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &local);
+    }
+    snprintf(buffer, size, "%-20s | %-5d | %-8d | %-8d | %s",
+             user_at(donation->user)->control_number,
+             donation->paper,
+             donation->plastic,
+             donation->aluminum,
+             date);
+}
+
+void render_user_list() {
+    static StatTimer timer = STAT_TIMER("render_user_list");
+    StatTimer *outer = view_enter(&timer);
+    render_table_view("Usuarios Registrados", "No. Control         | Nombre", 72,
+                      &users.count, format_user_row, NULL, "No hay usuarios registrados.");
+    view_leave(outer);
 }
 
 void render_donation_list() {
-    clear();
-    char* banner_text = read_asset_file(BANNER_FILE);
-    render_navbar(banner_text);
-    free(banner_text);
-
-    int list_y = 8;
-    int list_x = (COLS - 70) / 2;
-    draw_rounded_box(list_y - 1, list_x - 2, LINES - 4, list_x + 72);
-    mvprintw(list_y, list_x, "Donaciones");
-    mvprintw(list_y + 2, list_x, "Usuario (No. Control) | Papel (kg) | Plastico (kg) | Aluminio (kg)");
-    mvhline(list_y + 3, list_x, '-', 70);
-
-    if (donation_count == 0) {
-        mvprintw(list_y + 4, list_x, "No hay donaciones registradas.");
-    } else {
-        for (int i = 0; i < donation_count; i++) {
-            mvprintw(list_y + 4 + i, list_x, "%-25s | %-10d | %-13d | %d",
-                     donations[i].user_control_number,
-                     donations[i].paper,
-                     donations[i].plastic,
-                     donations[i].aluminum);
+    static StatTimer timer = STAT_TIMER("render_donation_list");
+    StatTimer *outer = view_enter(&timer);
+    render_table_view("Donaciones (kg)", donation_header, 70,
+                      &donations.count, format_donation_row, NULL, "No hay donaciones registradas.");
+    view_leave(outer);
+}
+
+// Filters users on every keystroke by control number or name prefix (see search_users).
+// Typing edits the query, so only Esc leaves; Enter opens the highlighted user's donations.
+void render_user_search() {
+    static StatTimer timer = STAT_TIMER("render_user_search");
+    StatTimer *outer = view_enter(&timer);
+    WINDOW *win = screen.content;
+    static SearchResult result; // too big for the stack, and only one search view is ever open
+    char query[MAX_NAME_LENGTH] = "";
+    size_t query_length = 0;
+    ListView view = { 0, 0, 0, 1 };
+    char row[256];
+    int width = 72;
+
+    while (true) {
+        int list_y = 1;
+        int list_x = (COLS - width) / 2;
+        int rows_y = list_y + 6;
+        int bottom_y = getmaxy(win) - 1;
+        int hint_y = bottom_y - 1;
+
+        // re-run every frame: a keystroke or another kiosk's insert may change the matches
+        bool searched = search_users(query, &result);
+        view.total = result.total;
+        view.height = hint_y - rows_y > 1 ? hint_y - rows_y : 1;
+        list_view_clamp(&view);
+
+        werase(win);
+        draw_rounded_box(win, list_y - 1, list_x - 2, bottom_y, list_x + width + 2);
+        mvwprintw(win, list_y, list_x, "Buscar Usuario");
+        wattron(win, COLOR_PAIR(COLOR_PAIR_INPUT));
+        mvwprintw(win, list_y + 2, list_x, "Buscar: %-*s", width - 8, query);
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_INPUT));
+        mvwprintw(win, list_y + 4, list_x, "No. Control         | Nombre");
+        mvwhline(win, list_y + 5, list_x, '-', width);
+
+        if (!searched) {
+            mvwprintw(win, rows_y, list_x, "No hay memoria suficiente para buscar.");
+        } else if (view.total == 0) {
+            mvwprintw(win, rows_y, list_x, "Ningun usuario coincide con la busqueda.");
+        } else {
+            int last = view.top + view.height < view.total ? view.top + view.height : view.total;
+            for (int i = view.top; i < last; i++) {
+                format_user_row(search_result_user(&result, i), row, sizeof(row));
+                if (i == view.selected) wattron(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+                mvwprintw(win, rows_y + i - view.top, list_x, "%-*.*s", width, width, row);
+                if (i == view.selected) wattroff(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+            }
+            char position[48];
+            int length = snprintf(position, sizeof(position), "%d-%d de %d", view.top + 1, last, view.total);
+            mvwprintw(win, list_y, list_x + width - length, "%s", position);
         }
+
+        mvwprintw(win, hint_y, list_x, "Escribe no. control o nombre, Enter: ver donaciones, Esc: volver");
+
+        int key = read_live_key();
+        if (key == 27) break;
+        if (key == 10) {
+            if (view.total > 0) render_user_history(search_result_user(&result, view.selected));
+            continue;
+        }
+        if (list_view_handle_key(&view, key)) continue;
+        if (key == KEY_BACKSPACE || key == 127 || key == 8) {
+            // drop a whole UTF-8 character, not just its last byte
+            while (query_length > 0 && ((unsigned char)query[--query_length] & 0xC0) == 0x80) {}
+            query[query_length] = '\0';
+        } else if (key >= 32 && key < 256 && key != 127 && query_length + 1 < sizeof(query)) {
+            query[query_length++] = (char)key;
+            query[query_length] = '\0';
+        } else {
+            continue;
+        }
+        view.selected = view.top = 0; // the query changed, start from the best match
+    }
+    view_leave(outer);
+}
+
+// Donation positions of the user whose history is open, collected when it opens and again
+// whenever the store is reloaded, since a new snapshot regroups the positions.
+static char history_owner[MAX_CONTROL_NUMBER_LENGTH] = "";
+static int *history = NULL;
+static int history_count = 0;
+static int history_capacity = 0;
+
+static void format_history_row(int row, char *buffer, size_t size) {
+    if (history[row] >= donations.count) { // collected before a reload shrank the table
+        buffer[0] = '\0';
+        return;
+    }
+    format_donation_row(history[row], buffer, size);
+}
+
+static bool history_reserve(int needed) {
+    if (needed <= history_capacity) return true;
+    int capacity = history_capacity ? history_capacity : 64;
+    while (capacity < needed) capacity *= 2;
+    int *grown = realloc(history, capacity * sizeof(int));
+    if (grown == NULL) return false;
+    history = grown;
+    history_capacity = capacity;
+    return true;
+}
+
+// Appends the user's donations among positions [first, last). Cold blocks whose dictionary
+// lacks the user are skipped without decoding them.
+static void collect_history(int user, int first, int last) {
+    for (int i = first; i < last; i++) {
+        if (i < cold.count) {
+            int next = cold_skip_user(i, (uint32_t)user);
+            if (next != i) {
+                i = next - 1;
+                continue;
+            }
+        }
+        if (donation_at(i)->user != (uint32_t)user) continue;
+        if (!history_reserve(history_count + 1)) return;
+        history[history_count++] = i;
+    }
+}
+
+// Copied from the per-user index (see history.c), so the cost follows the user's own
+// donations and not the size of the database. A user of a center that isn't loaded yet
+// isn't indexed: only the owner's sections and the donations after the sections are read
+// then, the rest of the snapshot stays untouched.
+static void load_history(int user) {
+    User *owner = user_at(user);
+    history_count = 0;
+    if (aggregates.ready && shard_loaded(owner->center)) {
+        int count = user_history_count(user);
+        if (!history_reserve(count)) return;
+        user_history_copy(user, history);
+        history_count = count;
+        return;
+    }
+    for (int s = 0; s < shards.section_count; s++) {
+        const ShardSection *section = &shards.sections[s];
+        if (section->center != owner->center) continue;
+        collect_history(user, (int)section->first, (int)(section->first + section->count));
+    }
+    collect_history(user, shards.sectioned, donations.count);
+}
+
+// Reloads the history of history_owner, found again by control number.
+static void refresh_history() {
+    int user = find_user_position(history_owner);
+    if (user >= 0) {
+        load_history(user);
+    } else {
+        history_count = 0;
     }
-    
-    mvprintw(LINES - 5, list_x, "-> Presiona una tecla para volver.");
-    getch();
 }
 
+void render_user_history(int user) {
+    static StatTimer timer = STAT_TIMER("render_user_history");
+    StatTimer *outer = view_enter(&timer);
+    snprintf(history_owner, sizeof(history_owner), "%s", user_at(user)->control_number);
+    load_history(user);
+
+    char title[96];
+    snprintf(title, sizeof(title), "Donaciones de %s (kg)", user_at(user)->name);
+    render_table_view(title, donation_header, 70,
+                      &history_count, format_history_row, refresh_history, "Este usuario no tiene donaciones.");
+    view_leave(outer);
+}
+
+// The logged-in user's own donations.
+void render_my_donations() {
+    static StatTimer timer = STAT_TIMER("render_my_donations");
+    StatTimer *outer = view_enter(&timer);
+    snprintf(history_owner, sizeof(history_owner), "%s", logged_in_user);
+    refresh_history();
+    render_table_view("Mis Donaciones (kg)", donation_header, 70,
+                      &history_count, format_history_row, refresh_history, "Aun no tienes donaciones registradas.");
+    view_leave(outer);
+}
+
+// Redrawn when the file changes on disk or the terminal is resized. The text is wrapped to
+// the box and only the rows that fit are drawn; arrows and paging keys scroll, any other
+// key goes back.
 void render_info_view(const char* title, const char* content_file) {
-    clear();
-    char* banner_text = read_asset_file(BANNER_FILE);
-    render_navbar(banner_text);
-    free(banner_text);
-    
-    char* content = read_asset_file(content_file);
-    int box_y = 8;
-    int box_x = (COLS - 70) / 2;
-    draw_rounded_box(box_y - 1, box_x - 2, LINES - 4, box_x + 72);
-    
-    attron(COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
-    mvprintw(box_y, box_x, title);
-    attroff(COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+    static StatTimer timer = STAT_TIMER("render_info_view");
+    StatTimer *outer = view_enter(&timer);
+    WINDOW *win = screen.content;
+    ListView view = { 0, 0, 0, 1 };
+    int key;
+
+    while (true) {
+        werase(win);
+        int width = COLS - 5 < INFO_TEXT_WIDTH ? COLS - 5 : INFO_TEXT_WIDTH; // box borders stay on screen
+        if (width < 1) width = 1;
+        const Asset* content = get_wrapped_asset(content_file, width);
+        int box_y = 1;
+        int box_x = (COLS - width) / 2;
+        int bottom_y = getmaxy(win) - 1;
+        int content_y = box_y + 2;
+        draw_rounded_box(win, box_y - 1, box_x - 2, bottom_y, box_x + width + 2);
+
+        wattron(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y, box_x, "%s", title);
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+
+        // scrolled as a list whose highlight is always the top row
+        view.total = content->row_count;
+        view.height = bottom_y - 1 - content_y > 1 ? bottom_y - 1 - content_y : 1;
+        if (view.top > view.total - view.height) view.top = view.total - view.height;
+        if (view.top < 0) view.top = 0;
+        view.selected = view.top;
+
+        int last = view.top + view.height < view.total ? view.top + view.height : view.total;
+        for (int i = view.top; i < last; i++) {
+            mvwaddnstr(win, content_y + i - view.top, box_x, content->rows[i].start, content->rows[i].length);
+        }
+        if (view.total > view.height) {
+            char position[48];
+            int length = snprintf(position, sizeof(position), "%d-%d de %d", view.top + 1, last, view.total);
+            mvwprintw(win, box_y, box_x + width - length, "%s", position);
+            mvwprintw(win, bottom_y - 1, box_x, "Flechas, RePag/AvPag: desplazar. Otra tecla: volver.");
+        } else {
+            mvwprintw(win, bottom_y - 1, box_x, "Presiona una tecla para volver.");
+        }
 
-    int content_y = box_y + 2;
-    
-    // el tomporal pasa eso
-    char* content_buffer = strdup(content);
-    char* line = strtok(content_buffer, "\n");
-    while(line != NULL && content_y < LINES - 5) {
-        mvprintw(content_y++, box_x, line);
-        line = strtok(NULL, "\n");
-    }
-    free(content_buffer);
-    free(content);
-
-    mvprintw(LINES - 5, box_x, "Presiona una tecla para volver.");
-    getch();
+        key = wait_event(EVENT_ASSETS);
+        if (key == KEY_ASSETS_CHANGED || key == KEY_RESIZE) continue;
+        if (key == KEY_DOWN) view.selected = last - 1; // scroll down from the bottom row
+        if (!list_view_handle_key(&view, key)) break;
+    }
+    view_leave(outer);
+}
+
+// Reports over the whole network merge the centers a --centro kiosk left out at startup
+// (see shards.c), once; the message covers the pause.
+static void load_all_centers() {
+    if (shards.all_loaded) return;
+    werase(screen.content);
+    mvwprintw(screen.content, 1, (COLS - 70) / 2, "Cargando los datos de los demas centros...");
+    present();
+    shards_load_all();
+}
+
+// Top donors per material, served from the leaderboard heaps: opening it or switching
+// material costs O(k log k), independent of how many donations are stored.
+void render_leaderboard() {
+    static StatTimer timer = STAT_TIMER("render_leaderboard");
+    StatTimer *outer = view_enter(&timer);
+    load_all_centers();
+    WINDOW *win = screen.content;
+    const char *material_names[MATERIAL_COUNT] = { "Papel", "Plastico", "Aluminio" };
+    int width = 70;
+    Material material = MATERIAL_PAPER;
+    int leaders[LEADERBOARD_MAX];
+
+    while (true) {
+        int box_y = 1;
+        int box_x = (COLS - width) / 2;
+        int bottom_y = getmaxy(win) - 1;
+        int rows_y = box_y + 6;
+        int k = bottom_y - 1 - rows_y;
+        if (k > LEADERBOARD_MAX) k = LEADERBOARD_MAX;
+
+        werase(win);
+        draw_rounded_box(win, box_y - 1, box_x - 2, bottom_y, box_x + width + 2);
+        wattron(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y, box_x, "Mejores Donadores");
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y + 1, box_x, "Total: Papel %lld kg | Plastico %lld kg | Aluminio %lld kg",
+                  (long long)aggregates.global.kg[MATERIAL_PAPER],
+                  (long long)aggregates.global.kg[MATERIAL_PLASTIC],
+                  (long long)aggregates.global.kg[MATERIAL_ALUMINUM]);
+
+        // material tabs
+        int tab_x = box_x;
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            if (m == (int)material) wattron(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+            mvwprintw(win, box_y + 3, tab_x, " %s ", material_names[m]);
+            if (m == (int)material) wattroff(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+            tab_x += strlen(material_names[m]) + 3;
+        }
+
+        mvwprintw(win, box_y + 4, box_x, " #  | No. Control         | Nombre                    | %s (kg)", material_names[material]);
+        mvwhline(win, box_y + 5, box_x, '-', width);
+
+        int found = top_donors(material, k, leaders);
+        if (found == 0) {
+            mvwprintw(win, rows_y, box_x, "Aun no hay donaciones de %s.", material_names[material]);
+        }
+        for (int i = 0; i < found; i++) {
+            const User *user = user_at(leaders[i]);
+            mvwprintw(win, rows_y + i, box_x, "%3d | %-19s | %-25.25s | %lld", i + 1, user->control_number, user->name,
+                      (long long)aggregates.per_user[leaders[i]].kg[material]);
+        }
+
+        mvwprintw(win, bottom_y - 1, box_x, "Izq/Der: cambiar material, q: volver");
+
+        int key = read_live_key();
+        if (key == 'q' || key == 27 || key == 10) break;
+        if (key == KEY_LEFT) material = (material + MATERIAL_COUNT - 1) % MATERIAL_COUNT;
+        if (key == KEY_RIGHT || key == '\t') material = (material + 1) % MATERIAL_COUNT;
+    }
+    view_leave(outer);
+}
+
+// Per-material report over every donation. The hot tier is recomputed with the SIMD kernels
+// over its columns each time the threshold changes, which stays interactive at tens of
+// millions of rows; the cold tier is answered from its block summaries.
+void render_statistics() {
+    static StatTimer timer = STAT_TIMER("render_statistics");
+    StatTimer *outer = view_enter(&timer);
+    load_all_centers();
+    WINDOW *win = screen.content;
+    const char *material_names[MATERIAL_COUNT] = { "Papel", "Plastico", "Aluminio" };
+    int width = 70;
+    int threshold = 10;
+
+    if (!columns_enable()) {
+        werase(win);
+        mvwprintw(win, 1, (COLS - width) / 2, "Memoria insuficiente para generar el reporte.");
+        read_key();
+        view_leave(outer);
+        return;
+    }
+    const ColumnKernels *kernels = column_kernels();
+
+    while (true) {
+        int box_y = 1;
+        int box_x = (COLS - width) / 2;
+        int bottom_y = getmaxy(win) - 1;
+        size_t n = (size_t)cold.count + columns.count;
+
+        werase(win);
+        draw_rounded_box(win, box_y - 1, box_x - 2, bottom_y, box_x + width + 2);
+        wattron(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y, box_x, "Estadisticas");
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y + 1, box_x, "%zu donaciones", n);
+        mvwprintw(win, box_y + 3, box_x, "Material | Total (kg)   | Promedio | Min    | Max    | >= %d kg", threshold);
+        mvwhline(win, box_y + 4, box_x, '-', width);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            const int32_t *column = material_column(m);
+            int y = box_y + 5 + m;
+            if (n == 0) {
+                mvwprintw(win, y, box_x, "%-8s | %-12d | -        | -      | -      | 0", material_names[m], 0);
+                continue;
+            }
+            MaterialSummary summary;
+            cold_summarize((Material)m, threshold, &summary);
+            int64_t sum = summary.sum;
+            int32_t min = summary.min, max = summary.max;
+            size_t over = (size_t)summary.at_least;
+            if (columns.count > 0) {
+                int32_t hot_min, hot_max;
+                kernels->min_max(column, columns.count, &hot_min, &hot_max);
+                sum += kernels->sum(column, columns.count);
+                if (hot_min < min) min = hot_min;
+                if (hot_max > max) max = hot_max;
+                over += kernels->count_at_least(column, columns.count, threshold);
+            }
+            mvwprintw(win, y, box_x, "%-8s | %-12lld | %-8.2f | %-6d | %-6d | %zu",
+                      material_names[m], (long long)sum, (double)sum / n, min, max, over);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long elapsed_us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+        mvwprintw(win, box_y + 9, box_x, "Calculado en %ld us (kernels %s)", elapsed_us, kernels->name);
+
+        mvwprintw(win, bottom_y - 1, box_x, "+/-: cambiar umbral, q: volver");
+
+        int key = read_live_key();
+        if (key == 'q' || key == 27 || key == 10) break;
+        if (key == '+' || key == KEY_UP) threshold++;
+        if ((key == '-' || key == KEY_DOWN) && threshold > 0) threshold--;
+    }
+    view_leave(outer);
+}
+
+// --- Date Report ---
+// Totals for a date range and their breakdown by day, week or month, answered from the
+// timeline rollups: the cost depends on how many periods are shown, not on the donations.
+
+typedef enum {
+    RANGE_TODAY,
+    RANGE_LAST_7_DAYS,
+    RANGE_LAST_30_DAYS,
+    RANGE_THIS_MONTH,
+    RANGE_LAST_MONTH,
+    RANGE_THIS_YEAR,
+    RANGE_CUSTOM,
+    RANGE_COUNT
+} ReportRange;
+
+static void format_report_time(int64_t timestamp, char *buffer, size_t size) {
+    time_t t = (time_t)timestamp;
+    struct tm local;
+    if (localtime_r(&t, &local) == NULL || strftime(buffer, size, "%Y-%m-%d %H:%M", &local) == 0) {
+        snprintf(buffer, size, "?");
+    }
+}
+
+// Label of one breakdown row: the day, the Monday starting the week, or the month.
+static void format_period(Period period, int number, char *buffer, size_t size) {
+    int year, month, mday;
+    timeline_date(timeline_period_start(period, number), &year, &month, &mday);
+    if (period == PERIOD_MONTH) {
+        snprintf(buffer, size, "%04d-%02d", year, month);
+    } else {
+        snprintf(buffer, size, "%s%04d-%02d-%02d", period == PERIOD_WEEK ? "Sem " : "", year, month, mday);
+    }
+}
+
+// Reads "AAAA-MM-DD" on the hint line. Returns the local day number or INT_MIN.
+static int prompt_day(WINDOW *win, int y, int x, const char *label) {
+    char input[16] = "";
+    wmove(win, y, x);
+    wclrtoeol(win);
+    mvwprintw(win, y, x, "%s (AAAA-MM-DD): ", label);
+    if (!read_field(win, y, getcurx(win), 10, input, sizeof(input))) return INT_MIN;
+
+    struct tm local;
+    memset(&local, 0, sizeof(local));
+    if (sscanf(input, "%d-%d-%d", &local.tm_year, &local.tm_mon, &local.tm_mday) != 3
+        || local.tm_mon < 1 || local.tm_mon > 12 || local.tm_mday < 1 || local.tm_mday > 31) {
+        return INT_MIN;
+    }
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_hour = 12; // noon never falls in a DST gap
+    local.tm_isdst = -1;
+    time_t t = mktime(&local);
+    return t == (time_t)-1 ? INT_MIN : timeline_day(t);
+}
+
+// Resolves a range to [from, to) in epoch seconds and a label. Rolling ranges end now.
+static void report_bounds(ReportRange range, int custom_first, int custom_last, int64_t *from, int64_t *to,
+                          char *label, size_t size) {
+    int64_t now = time(NULL);
+    int today = timeline_day(now);
+    int this_month = timeline_period(PERIOD_MONTH, today);
+    *to = now + 1;
+    switch (range) {
+        case RANGE_TODAY:
+            *from = timeline_day_start(today);
+            snprintf(label, size, "Hoy");
+            break;
+        case RANGE_LAST_7_DAYS:
+            *from = now - 7 * 86400;
+            snprintf(label, size, "Ultimos 7 dias");
+            break;
+        case RANGE_LAST_30_DAYS:
+            *from = now - 30 * 86400;
+            snprintf(label, size, "Ultimos 30 dias");
+            break;
+        case RANGE_THIS_MONTH:
+            *from = timeline_day_start(timeline_period_start(PERIOD_MONTH, this_month));
+            snprintf(label, size, "Este mes");
+            break;
+        case RANGE_LAST_MONTH:
+            *from = timeline_day_start(timeline_period_start(PERIOD_MONTH, this_month - 1));
+            *to = timeline_day_start(timeline_period_start(PERIOD_MONTH, this_month));
+            snprintf(label, size, "Mes anterior");
+            break;
+        case RANGE_THIS_YEAR:
+            *from = timeline_day_start(timeline_period_start(PERIOD_MONTH, this_month - this_month % 12));
+            snprintf(label, size, "Este ano");
+            break;
+        default:
+            *from = timeline_day_start(custom_first);
+            *to = timeline_day_start(custom_last + 1);
+            snprintf(label, size, "Personalizado");
+            break;
+    }
+}
+
+void render_date_report() {
+    static StatTimer timer = STAT_TIMER("render_date_report");
+    StatTimer *outer = view_enter(&timer);
+    load_all_centers();
+    WINDOW *win = screen.content;
+    const char *period_names[PERIOD_COUNT] = { "dia", "semana", "mes" };
+    int width = 70;
+    ReportRange range = RANGE_LAST_7_DAYS;
+    Period period = PERIOD_DAY;
+    int today = timeline_day(time(NULL));
+    int custom_first = today, custom_last = today;
+    ListView view = { 0, 0, 0, 1 };
+
+    while (true) {
+        int box_y = 1;
+        int box_x = (COLS - width) / 2;
+        int bottom_y = getmaxy(win) - 1;
+        int hint_y = bottom_y - 1;
+        int rows_y = box_y + 10;
+
+        char label[32], from_text[20], to_text[20];
+        int64_t from, to;
+        report_bounds(range, custom_first, custom_last, &from, &to, label, sizeof(label));
+        format_report_time(from, from_text, sizeof(from_text));
+        format_report_time(to - 1, to_text, sizeof(to_text));
+
+        // one row per period touching the range, newest first
+        int last_period = timeline_period(period, timeline_day(to - 1));
+        int first_period = timeline_period(period, timeline_day(from));
+        view.total = from < to ? last_period - first_period + 1 : 0;
+        view.height = hint_y - rows_y > 1 ? hint_y - rows_y : 1;
+        list_view_clamp(&view);
+
+        werase(win);
+        draw_rounded_box(win, box_y - 1, box_x - 2, bottom_y, box_x + width + 2);
+        wattron(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y, box_x, "Reporte por Fechas");
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_TITLE) | A_BOLD);
+        mvwprintw(win, box_y + 1, box_x, "%s: %s a %s", label, from_text, to_text);
+        if (aggregates.timeline.undated.count > 0) {
+            mvwprintw(win, box_y + 2, box_x, "%d donaciones anteriores sin fecha no se incluyen.",
+                      aggregates.timeline.undated.count);
+        }
+        mvwprintw(win, box_y + 4, box_x, "%-14s | Donaciones | Papel kg | Plastico kg | Aluminio kg", "");
+        mvwhline(win, box_y + 5, box_x, '-', width);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        RollupBucket total;
+        timeline_range(from, to, &total);
+        mvwprintw(win, box_y + 6, box_x, "%-14s | %-10d | %-8lld | %-11lld | %lld", "Total", total.count,
+                  (long long)total.totals.kg[MATERIAL_PAPER], (long long)total.totals.kg[MATERIAL_PLASTIC],
+                  (long long)total.totals.kg[MATERIAL_ALUMINUM]);
+
+        mvwprintw(win, box_y + 8, box_x, "Por %s:", period_names[period]);
+        int last = view.top + view.height < view.total ? view.top + view.height : view.total;
+        for (int i = view.top; i < last; i++) {
+            int number = last_period - i;
+            int64_t period_from = timeline_day_start(timeline_period_start(period, number));
+            int64_t period_to = timeline_day_start(timeline_period_start(period, number + 1));
+            RollupBucket bucket;
+            timeline_range(period_from > from ? period_from : from, period_to < to ? period_to : to, &bucket);
+            char name[20];
+            format_period(period, number, name, sizeof(name));
+            if (i == view.selected) wattron(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+            mvwprintw(win, rows_y + i - view.top, box_x, "%-14s | %-10d | %-8lld | %-11lld | %-11lld", name, bucket.count,
+                      (long long)bucket.totals.kg[MATERIAL_PAPER], (long long)bucket.totals.kg[MATERIAL_PLASTIC],
+                      (long long)bucket.totals.kg[MATERIAL_ALUMINUM]);
+            if (i == view.selected) wattroff(win, COLOR_PAIR(COLOR_PAIR_BUTTON_HIGHLIGHT));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long elapsed_us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+        char timing[32];
+        int length = snprintf(timing, sizeof(timing), "Calculado en %ld us", elapsed_us);
+        mvwprintw(win, box_y, box_x + width - length, "%s", timing);
+
+        mvwprintw(win, hint_y, box_x, "Izq/Der: rango, d/s/m: por dia/semana/mes, f: fechas, q: volver");
+
+        int key = read_live_key();
+        if (key == 'q' || key == 27 || key == 10) break;
+        if (list_view_handle_key(&view, key)) continue;
+        if (key == KEY_LEFT || key == KEY_RIGHT) {
+            range = (range + (key == KEY_LEFT ? RANGE_COUNT - 1 : 1)) % RANGE_COUNT;
+        } else if (key == 'd' || key == 's' || key == 'm') {
+            period = key == 'd' ? PERIOD_DAY : key == 's' ? PERIOD_WEEK : PERIOD_MONTH;
+        } else if (key == 'f') {
+            int first = prompt_day(win, hint_y, box_x, "Desde");
+            int last_day = first == INT_MIN ? INT_MIN : prompt_day(win, hint_y, box_x, "Hasta");
+            if (last_day == INT_MIN || last_day < first) continue;
+            custom_first = first;
+            custom_last = last_day;
+            range = RANGE_CUSTOM;
+        } else {
+            continue;
+        }
+        view.selected = view.top = 0;
+    }
+    view_leave(outer);
 }
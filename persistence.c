@@ -0,0 +1,1696 @@
+/*
+ * File:        persistence.c
+ * Project:     Crucible
+ * Description: Snapshots (text and memory-mapped binary), the append-only journal,
+ *              checkpoints and conversion between formats.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+Journal journal = { NULL, 0, 0, 0, 0, false, 0 };
+
+// new databases start out binary; an existing snapshot keeps whatever format it has
+DataFormat data_format = FORMAT_BINARY;
+void *snapshot_map = NULL;
+size_t snapshot_map_length = 0;
+
+// --- data file paths ---
+const char* DATA_FILE = "recycling_data.dat";
+const char* JOURNAL_FILE = "recycling_data.dat.journal";
+const char* SHARED_FILE = "recycling_data.dat.shm";
+const char* SERVER_SOCKET_FILE = "recycling_data.dat.sock";
+
+// --- Database ---
+// The snapshot (DATA_FILE) holds every record up to the last checkpoint and carries its
+// checkpoint id (a "C|<id>" first line in text, a header field in binary). Inserts since then are appended to JOURNAL_FILE, whose first line "J|<id>"
+// names the snapshot it extends. A journal whose id doesn't match the snapshot was already
+// folded in by a checkpoint that crashed before resetting it, so it is skipped on load.
+// Checkpoints run while inserts continue (see Checkpoints), so a new journal may start
+// with records carried over from the old one: "J|<id>|<carried bytes>".
+
+// Writes one record line; shared by the snapshot and the journal so both parse the same way.
+// "U|<control>|<name>" for users without a center, "R|<center>|<control>|<name>" otherwise.
+static void write_user_record(FILE *file, const User *user) {
+    if (user->center == 0) {
+        fprintf(file, "U|%s|%s\n", user->control_number, user->name);
+    } else {
+        fprintf(file, "R|%d|%s|%s\n", user->center, user->control_number, user->name);
+    }
+}
+
+// "D|<control>|<paper>|<plastic>|<aluminum>|<timestamp>"; files from before donations were
+// dated lack the last field and load as undated. The donor is looked up in users, the
+// image's table when a checkpoint writes it.
+static void write_donation_record(FILE *file, const RecordArena *users, const Donation *donation) {
+    const User *donor = arena_at(users, (int)donation->user);
+    fprintf(file, "D|%s|%d|%d|%d|%lld\n", donor->control_number, donation->paper, donation->plastic,
+            donation->aluminum, (long long)donation->timestamp);
+}
+
+// --- Text Records ---
+// One parsed line of the text format. Strings point into the line and aren't terminated.
+typedef struct {
+    char kind; // 'U', 'R', 'D' or 'C'
+    uint8_t control_length;
+    uint8_t name_length;
+    const char *control_number;
+    const char *name;
+    int paper;
+    int plastic;
+    int aluminum;
+    int64_t value; // a donation's timestamp, an R line's center, a C line's checkpoint id
+} TextRecord;
+
+// "[ws][-]digits", like scanf's %d; advances *cursor past it.
+static bool parse_integer(const char **cursor, const char *end, int64_t *value) {
+    const char *p = *cursor;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    bool negative = p < end && *p == '-';
+    if (negative || (p < end && *p == '+')) p++;
+    if (p == end || *p < '0' || *p > '9') return false;
+    uint64_t parsed = 0;
+    while (p < end && *p >= '0' && *p <= '9') parsed = parsed * 10 + (uint64_t)(*p++ - '0');
+    *value = negative ? -(int64_t)parsed : (int64_t)parsed;
+    *cursor = p;
+    return true;
+}
+
+// Parses the line [line, end) (no newline). Fields are cut to the record sizes and missing
+// trailing numbers are 0, as the old sscanf loader did; false for lines that aren't records
+// (headers, markers, blanks).
+static bool parse_record_line(const char *line, const char *end, TextRecord *record) {
+    if (end > line && end[-1] == '\r') end--;
+    if (end - line < 3 || line[1] != '|' || strchr("URDC", line[0]) == NULL) return false;
+    memset(record, 0, sizeof(*record));
+    record->kind = line[0];
+    const char *p = line + 2;
+    if (record->kind == 'C') return parse_integer(&p, end, &record->value);
+    if (record->kind == 'R' && (!parse_integer(&p, end, &record->value) || record->value < 0
+                                || record->value >= MAX_CENTERS || p == end || *p++ != '|')) {
+        return false;
+    }
+
+    const char *bar = memchr(p, '|', (size_t)(end - p));
+    const char *field_end = bar != NULL ? bar : end;
+    if (field_end == p) return false;
+    size_t length = (size_t)(field_end - p);
+    record->control_number = p;
+    record->control_length = length < MAX_CONTROL_NUMBER_LENGTH ? length : MAX_CONTROL_NUMBER_LENGTH - 1;
+    if (bar == NULL || length >= MAX_CONTROL_NUMBER_LENGTH) return true;
+    p = bar + 1;
+
+    if (record->kind == 'U' || record->kind == 'R') {
+        length = (size_t)(end - p);
+        record->name = p;
+        record->name_length = length < MAX_NAME_LENGTH ? length : MAX_NAME_LENGTH - 1;
+        return true;
+    }
+    int64_t value;
+    int *quantities[] = { &record->paper, &record->plastic, &record->aluminum };
+    for (int i = 0; i < 3; i++) {
+        if ((i > 0 && (p == end || *p++ != '|')) || !parse_integer(&p, end, &value)) return true;
+        *quantities[i] = (int)value;
+    }
+    if (p < end && *p++ == '|') parse_integer(&p, end, &record->value); // absent before donations were dated
+    return true;
+}
+
+static void apply_record(const TextRecord *record) {
+    if (record->kind == 'C') {
+        journal.checkpoint_id = (long)record->value;
+        return;
+    }
+    char control_number[MAX_CONTROL_NUMBER_LENGTH];
+    memcpy(control_number, record->control_number, record->control_length);
+    control_number[record->control_length] = '\0';
+    if (record->kind == 'U' || record->kind == 'R') {
+        char name[MAX_NAME_LENGTH];
+        if (record->name_length > 0) memcpy(name, record->name, record->name_length);
+        name[record->name_length] = '\0';
+        add_user_at(control_number, name, (int)(record->kind == 'R' ? record->value : 0));
+    } else {
+        add_donation(control_number, record->paper, record->plastic, record->aluminum, record->value);
+    }
+}
+
+// Applies one U|/R|/D| line to the store. Anything else (headers, blanks) is ignored.
+static void apply_record_line(const char* line) {
+    TextRecord record;
+    if (parse_record_line(line, line + strcspn(line, "\n"), &record) && record.kind != 'C') apply_record(&record);
+}
+
+// fsync the directory holding path so a rename into it survives a power cut.
+static void sync_parent_dir(const char* path) {
+    char dir[PATH_MAX] = ".";
+    const char *slash = strrchr(path, '/');
+    if (slash != NULL) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// --- Shared Store ---
+// Several kiosk processes can run on one database. They coordinate through SHARED_FILE, a
+// small file every process maps shared:
+//  - Every append and checkpoint happens under an fcntl write lock on it. The lock holder
+//    first catches up with what the others appended, so its own records land at the real
+//    end of the journal and a checkpoint never drops somebody else's inserts.
+//  - After writing, the holder publishes the committed journal length and the checkpoint
+//    id in the mapped SharedHeader under a seqlock.
+//  - Readers poll that header without locking (store_refresh) and apply the new journal
+//    bytes straight from the file: bytes below the published length are never rewritten.
+// A checkpoint renames a new journal into place instead of truncating the old one, so a
+// process that still has the old file open can finish reading it before switching over.
+
+static struct {
+    int fd;
+    SharedHeader *header;
+    int lock_depth;        // the lock nests, only the outermost call touches the file lock
+    pthread_mutex_t mutex; // recursive; orders our own threads before the file lock
+} shared = { .fd = -1 };
+
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+static _Thread_local int store_depth = 0; // store_lock nesting on this thread
+
+static bool load_store();
+static bool persist_checkpoint_pending();
+static void persist_wait_checkpoint();
+static void persist_throttle();
+
+static void shared_init() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&shared.mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// Maps SHARED_FILE, creating it zero-filled if needed. Without it we still run, just
+// without seeing other processes.
+static bool shared_open() {
+    if (shared.header != NULL) return true;
+    if (shared.fd < 0) shared.fd = open(SHARED_FILE, O_RDWR | O_CREAT, 0644);
+    if (shared.fd < 0) return false;
+
+    struct stat st;
+    if (fstat(shared.fd, &st) != 0) return false;
+    if (st.st_size < (off_t)sizeof(SharedHeader) && ftruncate(shared.fd, sizeof(SharedHeader)) != 0) return false;
+    void *map = mmap(NULL, sizeof(SharedHeader), PROT_READ | PROT_WRITE, MAP_SHARED, shared.fd, 0);
+    if (map == MAP_FAILED) return false;
+    shared.header = map;
+    return true;
+}
+
+static void shared_close() {
+    if (shared.header != NULL) munmap(shared.header, sizeof(SharedHeader));
+    if (shared.fd >= 0) close(shared.fd); // also drops our fcntl lock
+    shared.header = NULL;
+    shared.fd = -1;
+    shared.lock_depth = 0;
+}
+
+// fcntl locks belong to the process, so our own threads first line up on the mutex.
+static void shared_acquire() {
+    pthread_once(&shared_once, shared_init);
+    pthread_mutex_lock(&shared.mutex);
+    if (shared.lock_depth++ > 0 || !shared_open()) return;
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    while (fcntl(shared.fd, F_SETLKW, &lock) == -1 && errno == EINTR) {}
+}
+
+static void shared_release() {
+    if (--shared.lock_depth == 0 && shared.header != NULL) {
+        struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET };
+        fcntl(shared.fd, F_SETLK, &lock);
+    }
+    pthread_mutex_unlock(&shared.mutex);
+}
+
+// Publishes the committed end of the journal. Only called with the lock held, so the header
+// always moves forward. Forcing the sequence odd first also repairs a writer that died
+// mid-update.
+static void shared_publish(int64_t journal_length) {
+    SharedHeader *header = shared.header;
+    if (header == NULL) return;
+    uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&header->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&header->checkpoint_id, journal.checkpoint_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->journal_length, journal_length, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+static bool shared_read(int64_t *checkpoint_id, int64_t *journal_length) {
+    SharedHeader *header = shared.header;
+    if (header == NULL) return false;
+    for (int attempt = 0; attempt < SHARED_READ_ATTEMPTS; attempt++) {
+        uint32_t before = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        *checkpoint_id = __atomic_load_n(&header->checkpoint_id, __ATOMIC_RELAXED);
+        *journal_length = __atomic_load_n(&header->journal_length, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == before) return true;
+    }
+    return false;
+}
+
+// Applies the complete journal lines between journal.offset and end (the end of the file
+// when end < 0). A trailing partial line is left for later.
+static void journal_apply(long end) {
+    static char buffer[16384];
+    while (end < 0 || journal.offset < end) {
+        size_t wanted = sizeof(buffer) - 1;
+        if (end >= 0 && (long)wanted > end - journal.offset) wanted = end - journal.offset;
+        ssize_t got = pread(fileno(journal.file), buffer, wanted, journal.offset);
+        if (got <= 0) return;
+        buffer[got] = '\0';
+
+        char *line = buffer;
+        char *newline;
+        while ((newline = memchr(line, '\n', buffer + got - line)) != NULL) {
+            *newline = '\0';
+            if (line[0] == 'U' || line[0] == 'R' || line[0] == 'D') journal.records++;
+            apply_record_line(line);
+            line = newline + 1;
+        }
+        if (line == buffer) return; // partial line
+        journal.offset += line - buffer;
+    }
+}
+
+// Another process checkpointed and renamed a new journal into place. Nobody appends to our
+// old file any more, so read it to the end, then continue with the new one.
+static bool journal_follow(long checkpoint_id) {
+    journal_apply(-1);
+    FILE *next = fopen(JOURNAL_FILE, "a+");
+    if (next == NULL) return false;
+
+    char line[64];
+    long journal_id = -1;
+    long carried = 0; // already read at the end of the old file
+    rewind(next);
+    if (!fgets(line, sizeof(line), next) || sscanf(line, "J|%ld|%ld", &journal_id, &carried) < 1 || journal_id != checkpoint_id) {
+        fclose(next);
+        return false;
+    }
+    long offset = ftell(next) + carried;
+    fseek(next, 0, SEEK_END); // switch the stream back to writing
+
+    fclose(journal.file);
+    journal.file = next;
+    journal.checkpoint_id = checkpoint_id;
+    journal.offset = offset;
+    journal.records = 0;
+    journal.unsynced = 0;
+    return true;
+}
+
+// We fell more than one checkpoint behind: start over from the current snapshot. Not while
+// our own checkpoint is being written, its image still points into the store.
+static void reload_store() {
+    bool had_columns = columns.enabled;
+    fclose(journal.file);
+    journal.file = NULL;
+    free_store();
+    journal.checkpoint_id = 0;
+    journal.offset = 0;
+    journal.records = 0;
+    journal.unsynced = 0;
+    load_store();
+    if (had_columns) columns_enable();
+}
+
+// Brings the store up to date with what other processes wrote. With the lock held nothing
+// moves underneath us, so this reads to the end of the file: that also recovers complete
+// records from a process that died before publishing them, and cuts a torn last line.
+// Returns false if it needs a reload that has to wait for our own checkpoint.
+static bool journal_catch_up() {
+    int64_t checkpoint_id, length;
+    if (journal.file == NULL || !shared_read(&checkpoint_id, &length)) return true;
+    if (checkpoint_id != journal.checkpoint_id
+        && (checkpoint_id != journal.checkpoint_id + 1 || !journal_follow(checkpoint_id))) {
+        if (persist_checkpoint_pending()) return false;
+        reload_store();
+        if (journal.file == NULL) return true;
+    }
+
+    journal_apply(-1);
+    struct stat st;
+    if (fstat(fileno(journal.file), &st) == 0 && st.st_size > journal.offset) {
+        if (ftruncate(fileno(journal.file), journal.offset) != 0) return true;
+    }
+    if (journal.offset != length || checkpoint_id != journal.checkpoint_id) shared_publish(journal.offset);
+    return true;
+}
+
+// Serializes writers across processes. Check-then-insert callers (register a user unless
+// the control number exists) hold it around both steps: taking it catches up first, so the
+// check sees the other kiosks' records.
+void store_lock() {
+    if (store_depth++ > 0) {
+        shared_acquire();
+        return;
+    }
+    while (true) {
+        persist_throttle(); // never wait for the writer while holding the lock it needs
+        shared_acquire();
+        if (journal_catch_up()) return;
+        shared_release();
+        persist_wait_checkpoint();
+    }
+}
+
+void store_unlock() {
+    store_depth--;
+    shared_release();
+}
+
+// Lock-free poll for records other processes appended, cheap enough for every idle tick.
+// Returns true if the store changed.
+bool store_refresh() {
+    pthread_once(&shared_once, shared_init);
+    if (pthread_mutex_trylock(&shared.mutex) != 0) return false; // our writer is swapping journals
+
+    int64_t checkpoint_id, length;
+    bool current = journal.file == NULL || shared.lock_depth > 0 || !shared_read(&checkpoint_id, &length)
+        || (checkpoint_id == journal.checkpoint_id && length <= journal.offset);
+    int before = users.count + donations.count;
+    if (!current && checkpoint_id == journal.checkpoint_id) {
+        journal_apply(length);
+        current = true;
+    }
+    pthread_mutex_unlock(&shared.mutex);
+    if (current) return users.count + donations.count != before;
+
+    // the journal was swapped by a checkpoint, follow it under the lock
+    store_lock();
+    store_unlock();
+    return true;
+}
+
+// Starts a fresh, empty journal on top of snapshot checkpoint_id. It is written under a
+// temporary name and renamed into place, so processes still reading the old journal keep
+// a complete file.
+static bool journal_reset() {
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", JOURNAL_FILE);
+
+    if (journal.file != NULL) fclose(journal.file);
+    journal.file = fopen(tmp_path, "a+");
+    if (journal.file == NULL) return false;
+    fprintf(journal.file, "J|%ld\n", journal.checkpoint_id);
+    if (fflush(journal.file) != 0 || fsync(fileno(journal.file)) != 0 || rename(tmp_path, JOURNAL_FILE) != 0) {
+        fclose(journal.file);
+        journal.file = NULL;
+        remove(tmp_path);
+        return false;
+    }
+    sync_parent_dir(JOURNAL_FILE);
+    journal.offset = ftell(journal.file);
+    journal.records = 0;
+    journal.unsynced = 0;
+    journal.last_sync = time(NULL);
+    return true;
+}
+
+// Hands buffered records to the kernel and, if that moved the end of the journal, tells
+// the other processes. The end only moves for the lock holder.
+static void journal_flush() {
+    fflush(journal.file);
+    long end = ftell(journal.file);
+    if (end > journal.offset) {
+        journal.offset = end;
+        shared_publish(end);
+    }
+}
+
+void journal_sync() {
+    if (journal.file == NULL || journal.unsynced == 0) return;
+    journal_flush();
+    fsync(fileno(journal.file));
+    journal.unsynced = 0;
+    journal.last_sync = time(NULL);
+}
+
+static bool persist_running();
+static void persist_committed();
+static void checkpoint_request();
+
+// Every record reaches the kernel right away (fflush), so a crashed process loses nothing.
+// The fsync that protects against power loss goes to the writer thread when it runs, and is
+// otherwise batched by count and age.
+static void journal_commit() {
+    journal.records++;
+    if (persist_running() && !journal.batching) {
+        journal_flush();
+        persist_committed();
+        if (journal.records >= JOURNAL_CHECKPOINT_RECORDS) checkpoint_request();
+        return;
+    }
+    journal.unsynced++;
+    if (journal.batching) return;
+
+    journal_flush();
+    if (journal.unsynced >= JOURNAL_SYNC_BATCH || time(NULL) - journal.last_sync >= JOURNAL_SYNC_INTERVAL) {
+        journal_sync();
+    }
+    if (journal.records >= JOURNAL_CHECKPOINT_RECORDS) {
+        save_data();
+    }
+}
+
+void journal_append_user(const User *user) {
+    store_lock();
+    if (journal.file == NULL && !journal_reset()) {
+        store_unlock();
+        save_data(); // no journal to lean on, fall back to a full snapshot
+        return;
+    }
+    write_user_record(journal.file, user);
+    journal_commit();
+    store_unlock();
+}
+
+void journal_append_donation(const Donation *donation) {
+    store_lock();
+    if (journal.file == NULL && !journal_reset()) {
+        store_unlock();
+        save_data();
+        return;
+    }
+    write_donation_record(journal.file, &users, donation);
+    journal_commit();
+    store_unlock();
+}
+
+void journal_close() {
+    if (journal.file != NULL) {
+        journal_sync();
+        fclose(journal.file);
+        journal.file = NULL;
+    }
+    shared_close();
+}
+
+// --- Store Images ---
+// What a snapshot is written from: the live store, or a frozen copy of it that a checkpoint
+// can write on the writer thread while inserts continue. Records never move once written, so
+// freezing only copies the chunk tables and the user index; the records stay shared.
+typedef struct {
+    RecordArena users;
+    RecordArena donations;
+    ColdTier cold;       // immutable, shared with the store
+    const IndexSlot *slots;
+    uint32_t capacity;
+    long checkpoint_id;  // id of the snapshot written from it
+    long journal_offset; // how much of the current journal it includes
+    int records;         // how many journal records that is
+    bool frozen;         // owns copies of the chunk tables and the index
+} StoreImage;
+
+static void image_of_store(StoreImage *image, long checkpoint_id) {
+    image->users = users;
+    image->donations = donations;
+    image->cold = cold;
+    image->slots = user_index.slots;
+    image->capacity = user_index.capacity;
+    image->checkpoint_id = checkpoint_id;
+    image->journal_offset = journal.offset;
+    image->records = journal.records;
+    image->frozen = false;
+}
+
+static char** copy_chunk_table(const RecordArena *arena) {
+    if (arena->chunk_count == 0) return NULL;
+    char **chunks = malloc(arena->chunk_count * sizeof(char*));
+    if (chunks != NULL) memcpy(chunks, arena->chunks, arena->chunk_count * sizeof(char*));
+    return chunks;
+}
+
+static const Donation* image_donation(const StoreImage *image, int i) {
+    return i < image->cold.count ? cold_donation(&image->cold, i) : arena_at(&image->donations, i);
+}
+
+static void image_release(StoreImage *image) {
+    if (!image->frozen) return;
+    free(image->users.chunks);
+    free(image->donations.chunks);
+    free((void*)image->slots);
+}
+
+// Call with the store lock held, right after catching up, so the image matches the journal
+// up to journal.offset.
+static bool image_freeze(StoreImage *image, long checkpoint_id) {
+    image_of_store(image, checkpoint_id);
+    image->users.chunks = copy_chunk_table(&users);
+    image->donations.chunks = copy_chunk_table(&donations);
+    IndexSlot *slots = NULL;
+    if (user_index.capacity > 0 && (slots = malloc(user_index.capacity * sizeof(IndexSlot))) != NULL) {
+        memcpy(slots, user_index.slots, user_index.capacity * sizeof(IndexSlot));
+    }
+    image->slots = slots;
+    image->frozen = true;
+    if ((users.chunk_count > 0 && image->users.chunks == NULL)
+        || (donations.chunk_count > 0 && image->donations.chunks == NULL)
+        || (user_index.capacity > 0 && slots == NULL)) {
+        image_release(image);
+        return false;
+    }
+    return true;
+}
+
+// --- Binary Snapshot ---
+// Layout: BinaryHeader, then the User records, the user index slots, the Donation records,
+// the ShardSection table, the cold tier's encoded records and its ColdBlock table, each
+// section 8-byte aligned. Donations older than COLD_AGE_DAYS are sealed into the cold tier
+// (see cold.c) and take the first positions; the rest stay plain records. Within each tier
+// donations are grouped by their donor's center, in insertion order within a center, and
+// the section table gives each center's run per tier (see shards.c). Loading maps the file
+// privately and points the arenas, the index and the cold tier straight at it, so startup
+// cost doesn't grow with the record count; pages are only faulted in as they are touched.
+// Inserts after load go to regular chunks (and copy-on-write index pages), the file itself
+// is never modified.
+// Version 4 predates the cold tier and loads with every donation hot. Versions 1 to 3
+// predate centers: their users are copied into chunks at center 0, which rebuilds the
+// index. Versions 1 and 2 also copied the donor's control number into every donation record
+// (and version 1 predates timestamps): their donations are converted into chunks as well.
+// The next checkpoint rewrites the file as the current version.
+
+// Donation record of a version 2 snapshot; version 1 is the same without the timestamp.
+typedef struct {
+    char user_control_number[MAX_CONTROL_NUMBER_LENGTH];
+    int paper;
+    int plastic;
+    int aluminum;
+    int64_t timestamp;
+} LegacyDonation;
+
+#define BINARY_V1_DONATION_SIZE offsetof(LegacyDonation, timestamp)
+#define BINARY_V3_USER_SIZE offsetof(User, center)
+#define BINARY_V3_HEADER_SIZE offsetof(BinaryHeader, section_count)
+#define BINARY_V4_HEADER_SIZE offsetof(BinaryHeader, cold_count)
+
+static bool copy_legacy_users(const char *records, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        User legacy = { .center = 0 };
+        memcpy(&legacy, records + i * BINARY_V3_USER_SIZE, BINARY_V3_USER_SIZE);
+        legacy.control_number[MAX_CONTROL_NUMBER_LENGTH - 1] = '\0';
+        legacy.name[MAX_NAME_LENGTH - 1] = '\0';
+        // donations refer to users by position, so a duplicate would shift every later one
+        if (add_user_at(legacy.control_number, legacy.name, 0) == NULL || (uint64_t)users.count != i + 1) return false;
+    }
+    return true;
+}
+
+static bool copy_legacy_donations(const char *records, uint64_t count, size_t record_size) {
+    for (uint64_t i = 0; i < count; i++) {
+        LegacyDonation legacy = { .timestamp = 0 };
+        memcpy(&legacy, records + i * record_size, record_size);
+        legacy.user_control_number[MAX_CONTROL_NUMBER_LENGTH - 1] = '\0';
+        if (add_donation(legacy.user_control_number, legacy.paper, legacy.plastic, legacy.aluminum,
+                         legacy.timestamp) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static bool write_padding(FILE *file, uint64_t target) {
+    static const char zeros[8] = { 0 };
+    long position = ftell(file);
+    return position >= 0 && fwrite(zeros, 1, target - (uint64_t)position, file) == target - (uint64_t)position;
+}
+
+// Where a snapshot puts each donation. One stable counting sort over the positions after
+// the image's cold tier: buckets [0, MAX_CENTERS) hold the donations this snapshot seals,
+// by center, and buckets [MAX_CENTERS, 2 * MAX_CENTERS) the ones that stay records.
+typedef struct {
+    int *order;
+    int start[2 * MAX_CENTERS + 1];
+    int sealed[MAX_CENTERS]; // donations in the image's cold blocks, per center
+    int sealing;             // donations sealed by this snapshot
+    int records;
+} SnapshotLayout;
+
+static bool layout_donations(const StoreImage *image, int64_t cutoff, SnapshotLayout *layout) {
+    memset(layout, 0, sizeof(*layout));
+    int first = image->cold.count;
+    int count = image->donations.count - first;
+    uint16_t *bucket = malloc(count > 0 ? (size_t)count * sizeof(uint16_t) : 1);
+    layout->order = malloc(count > 0 ? (size_t)count * sizeof(int) : 1);
+    if (bucket == NULL || layout->order == NULL) {
+        free(bucket);
+        free(layout->order);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const Donation *donation = arena_at(&image->donations, first + i);
+        int center = ((const User*)arena_at(&image->users, (int)donation->user))->center;
+        bucket[i] = (uint16_t)(donation->timestamp < cutoff ? center : MAX_CENTERS + center);
+        layout->start[bucket[i] + 1]++;
+    }
+    for (int b = 0; b < 2 * MAX_CENTERS; b++) layout->start[b + 1] += layout->start[b];
+    int next[2 * MAX_CENTERS];
+    memcpy(next, layout->start, sizeof(next));
+    for (int i = 0; i < count; i++) layout->order[next[bucket[i]]++] = first + i;
+    free(bucket);
+
+    for (int b = 0; b < image->cold.block_count; b++) {
+        layout->sealed[image->cold.blocks[b].center] += image->cold.blocks[b].count;
+    }
+    layout->sealing = layout->start[MAX_CENTERS];
+    layout->records = count - layout->sealing;
+    return true;
+}
+
+// One section per center and tier, cold tier first, in position order.
+static int layout_sections(const SnapshotLayout *layout, ShardSection *sections) {
+    int section_count = 0;
+    uint64_t position = 0;
+    for (int tier = 0; tier < 2; tier++) {
+        for (int c = 0; c < MAX_CENTERS; c++) {
+            int b = tier * MAX_CENTERS + c;
+            uint64_t count = (uint64_t)(layout->start[b + 1] - layout->start[b]) + (tier == 0 ? (uint64_t)layout->sealed[c] : 0);
+            if (count == 0) continue;
+            sections[section_count++] = (ShardSection){ (uint32_t)c, 0, position, count };
+            position += count;
+        }
+    }
+    return section_count;
+}
+
+// Writes the donations that stay records, grouped by center, buffered so they go out in
+// large writes.
+static bool write_donation_records(FILE *file, const StoreImage *image, const SnapshotLayout *layout) {
+    Donation *buffer = malloc(4096 * sizeof(Donation));
+    const int *order = layout->order + layout->sealing;
+    bool written = buffer != NULL;
+    for (int i = 0; i < layout->records && written; i += 4096) {
+        int n = layout->records - i < 4096 ? layout->records - i : 4096;
+        for (int j = 0; j < n; j++) buffer[j] = *(const Donation*)arena_at(&image->donations, order[i + j]);
+        written = fwrite(buffer, sizeof(Donation), n, file) == (size_t)n;
+    }
+    free(buffer);
+    return written;
+}
+
+typedef struct {
+    ColdBlock *blocks;
+    int count;
+    int capacity;
+    uint64_t payload_length;
+} ColdWriter;
+
+static bool cold_write_block(FILE *file, ColdWriter *writer, ColdBlock *block, const void *bytes) {
+    if (writer->count == writer->capacity) {
+        int capacity = writer->capacity ? writer->capacity * 2 : 256;
+        ColdBlock *grown = realloc(writer->blocks, (size_t)capacity * sizeof(ColdBlock));
+        if (grown == NULL) return false;
+        writer->blocks = grown;
+        writer->capacity = capacity;
+    }
+    block->first = writer->count > 0 ? writer->blocks[writer->count - 1].first + writer->blocks[writer->count - 1].count : 0;
+    block->offset = writer->payload_length;
+    if (fwrite(bytes, 1, block->bytes, file) != block->bytes) return false;
+    writer->payload_length += block->bytes;
+    writer->blocks[writer->count++] = *block;
+    return true;
+}
+
+// Writes the cold tier's encoded records, center by center: the image's sealed blocks as
+// they are, then the donations sealed now, encoded into new blocks.
+static bool write_cold_payload(FILE *file, const StoreImage *image, const SnapshotLayout *layout, ColdWriter *writer) {
+    Donation *records = malloc(COLD_BLOCK_RECORDS * sizeof(Donation));
+    uint8_t *encoded = malloc(COLD_BLOCK_RECORDS * 48);
+    bool written = records != NULL && encoded != NULL;
+    int old = 0;
+    for (int c = 0; c < MAX_CENTERS && written; c++) {
+        for (; old < image->cold.block_count && image->cold.blocks[old].center == (uint32_t)c && written; old++) {
+            ColdBlock block = image->cold.blocks[old];
+            written = cold_write_block(file, writer, &block, image->cold.payload + block.offset);
+        }
+        for (int i = layout->start[c]; i < layout->start[c + 1] && written; i += COLD_BLOCK_RECORDS) {
+            int n = layout->start[c + 1] - i < COLD_BLOCK_RECORDS ? layout->start[c + 1] - i : COLD_BLOCK_RECORDS;
+            for (int j = 0; j < n; j++) records[j] = *(const Donation*)arena_at(&image->donations, layout->order[i + j]);
+            ColdBlock block;
+            cold_encode(records, n, encoded, &block);
+            block.center = (uint32_t)c;
+            written = cold_write_block(file, writer, &block, encoded);
+        }
+    }
+    free(records);
+    free(encoded);
+    return written;
+}
+
+static bool write_binary_snapshot(FILE *file, const StoreImage *image) {
+    SnapshotLayout layout;
+    if (!layout_donations(image, (int64_t)time(NULL) - (int64_t)COLD_AGE_DAYS * 86400, &layout)) return false;
+    ShardSection sections[2 * MAX_CENTERS];
+    int section_count = layout_sections(&layout, sections);
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.byte_order = BINARY_BYTE_ORDER;
+    header.user_record_size = sizeof(User);
+    header.donation_record_size = sizeof(Donation);
+    header.checkpoint_id = image->checkpoint_id;
+    header.user_count = image->users.count;
+    header.user_offset = align8(sizeof(header));
+    header.index_capacity = image->capacity;
+    header.index_offset = align8(header.user_offset + header.user_count * sizeof(User));
+    header.donation_count = layout.records;
+    header.donation_offset = align8(header.index_offset + header.index_capacity * sizeof(IndexSlot));
+    header.section_count = section_count;
+    header.section_offset = align8(header.donation_offset + header.donation_count * sizeof(Donation));
+    header.cold_count = image->cold.count + layout.sealing;
+    header.payload_offset = align8(header.section_offset + header.section_count * sizeof(ShardSection));
+
+    // the header goes first but the cold tier's size is only known once it is encoded, so
+    // the header is rewritten at the end
+    ColdWriter writer = { NULL, 0, 0, 0 };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && write_padding(file, header.user_offset)
+        && arena_write(&image->users, file)
+        && write_padding(file, header.index_offset)
+        && (header.index_capacity == 0 || fwrite(image->slots, sizeof(IndexSlot), header.index_capacity, file) == header.index_capacity)
+        && write_padding(file, header.donation_offset)
+        && write_donation_records(file, image, &layout)
+        && write_padding(file, header.section_offset)
+        && (section_count == 0 || fwrite(sections, sizeof(ShardSection), section_count, file) == (size_t)section_count)
+        && write_padding(file, header.payload_offset)
+        && write_cold_payload(file, image, &layout, &writer);
+    if (written) {
+        header.block_count = writer.count;
+        header.payload_length = writer.payload_length;
+        header.block_offset = align8(header.payload_offset + header.payload_length);
+        written = write_padding(file, header.block_offset)
+            && (writer.count == 0 || fwrite(writer.blocks, sizeof(ColdBlock), writer.count, file) == (size_t)writer.count)
+            && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 && fseek(file, 0, SEEK_END) == 0;
+    }
+    free(writer.blocks);
+    free(layout.order);
+    return written;
+}
+
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t record_size, uint64_t length) {
+    return offset <= length && count <= (length - offset) / record_size;
+}
+
+// The sections must tile the donations in order.
+static bool sections_valid(const ShardSection *sections, uint64_t count, uint64_t donation_count) {
+    uint64_t next = 0;
+    for (uint64_t s = 0; s < count; s++) {
+        if (sections[s].center >= MAX_CENTERS || sections[s].first != next || sections[s].count == 0
+            || sections[s].count > donation_count - next) {
+            return false;
+        }
+        next += sections[s].count;
+    }
+    return next == donation_count;
+}
+
+// Every user reference in the mapped records must name a mapped user, or a damaged file
+// would send the aggregates and the index probe past the user table.
+static bool user_refs_valid(const IndexSlot *slots, uint64_t capacity, const Donation *records, uint64_t count,
+                            uint64_t user_count) {
+    for (uint64_t i = 0; i < capacity; i++) {
+        if (slots[i].user < 0 || (uint64_t)slots[i].user > user_count) return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (records[i].user >= user_count) return false;
+    }
+    return true;
+}
+
+// Maps a binary snapshot into the (empty) store. Fails on a foreign or truncated file.
+static bool map_binary_snapshot(int fd, size_t length) {
+    if (length < BINARY_V3_HEADER_SIZE) return false;
+
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return false;
+
+    const BinaryHeader *header = map;
+    uint64_t capacity = header->index_capacity;
+    bool legacy = header->version >= 1 && header->version <= 3;
+    bool sectioned = header->version == 4 || header->version == BINARY_VERSION;
+    bool tiered = header->version == BINARY_VERSION;
+    uint64_t cold_count = tiered ? header->cold_count : 0;
+    size_t user_size = legacy ? BINARY_V3_USER_SIZE : sizeof(User);
+    size_t donation_size = header->version == 1 ? BINARY_V1_DONATION_SIZE
+        : header->version == 2 ? sizeof(LegacyDonation) : sizeof(Donation);
+    bool valid = (legacy || sectioned)
+        && length >= (tiered ? sizeof(BinaryHeader) : sectioned ? BINARY_V4_HEADER_SIZE : BINARY_V3_HEADER_SIZE)
+        && header->byte_order == BINARY_BYTE_ORDER
+        && header->user_record_size == user_size
+        && header->donation_record_size == donation_size
+        && header->user_count <= INT32_MAX && cold_count <= INT32_MAX && header->donation_count <= INT32_MAX - cold_count
+        && (capacity & (capacity - 1)) == 0 && capacity <= UINT32_MAX
+        && (capacity == 0 ? header->user_count == 0 : header->user_count * 10 < capacity * 7)
+        && header->user_offset % 8 == 0 && header->index_offset % 8 == 0 && header->donation_offset % 8 == 0
+        && section_fits(header->user_offset, header->user_count, user_size, length)
+        && section_fits(header->index_offset, capacity, sizeof(IndexSlot), length)
+        && section_fits(header->donation_offset, header->donation_count, donation_size, length);
+    if (valid && sectioned) {
+        valid = header->section_offset % 8 == 0
+            && section_fits(header->section_offset, header->section_count, sizeof(ShardSection), length)
+            && sections_valid((const ShardSection*)((char*)map + header->section_offset), header->section_count,
+                              cold_count + header->donation_count);
+    }
+    if (valid && tiered) {
+        valid = header->block_offset % 8 == 0
+            && section_fits(header->block_offset, header->block_count, sizeof(ColdBlock), length)
+            && section_fits(header->payload_offset, header->payload_length, 1, length)
+            && cold_blocks_valid((const ColdBlock*)((char*)map + header->block_offset), header->block_count,
+                                 header->payload_length, cold_count);
+    }
+    if (valid && header->version >= 3) {
+        // v1 and v2 donations name their user by control number and are re-added instead
+        valid = user_refs_valid(legacy ? NULL : (const IndexSlot*)((char*)map + header->index_offset),
+                                legacy ? 0 : capacity,
+                                (const Donation*)((char*)map + header->donation_offset), header->donation_count,
+                                header->user_count)
+            && (header->user_count > 0 || cold_count == 0);
+    }
+    if (!valid) {
+        munmap(map, length);
+        return false;
+    }
+
+    snapshot_map = map;
+    snapshot_map_length = length;
+    journal.checkpoint_id = header->checkpoint_id;
+
+    if (legacy) {
+        if (!copy_legacy_users((char*)map + header->user_offset, header->user_count)) return false;
+        if (header->version < 3) {
+            return copy_legacy_donations((char*)map + header->donation_offset, header->donation_count, donation_size);
+        }
+    } else {
+        users.base = (char*)map + header->user_offset;
+        users.base_count = users.count = header->user_count;
+        if (capacity > 0) {
+            user_index.slots = (IndexSlot*)((char*)map + header->index_offset);
+            user_index.capacity = capacity;
+            user_index.count = header->user_count;
+            user_index.mapped = true;
+        }
+        shards.sections = (const ShardSection*)((char*)map + header->section_offset);
+        shards.section_count = (int)header->section_count;
+        shards.sectioned = (int)(cold_count + header->donation_count);
+    }
+    if (tiered) {
+        cold_attach((const ColdBlock*)((char*)map + header->block_offset), (int)header->block_count,
+                    (const uint8_t*)map + header->payload_offset, (int)cold_count);
+    }
+    donations.base = (char*)map + header->donation_offset;
+    donations.base_first = (int)cold_count;
+    donations.base_count = donations.count = (int)(cold_count + header->donation_count);
+    return true;
+}
+
+// --- Text Loader ---
+// Text snapshots and journals are mapped and cut into TEXT_LOAD_CHUNK pieces at line
+// boundaries. Worker threads parse chunks into TextRecord arrays while this thread applies
+// the finished ones in file order: the store and its index stay single-threaded, and the
+// parsing, which dominated the old fgets/sscanf loader, spreads over the cores. At most two
+// chunks per worker are parsed ahead, which bounds the memory a multi-gigabyte file needs.
+// With one core or one chunk the records are parsed and applied in place.
+
+typedef struct {
+    const char *start;
+    const char *end;
+    TextRecord *records; // NULL if parsing ran out of memory: applied from the text instead
+    int count;
+    bool parsed;
+} TextChunk;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    TextChunk *chunks;
+    int chunk_count;
+    int next;    // next chunk a worker takes
+    int applied; // chunks applied so far
+    int ahead;   // how far past applied the workers may go
+} loader = { .mutex = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+
+// Parses and applies [start, end) on the calling thread; returns the U/R/D records applied.
+static long apply_text(const char *start, const char *end) {
+    long records = 0;
+    TextRecord record;
+    while (start < end) {
+        const char *newline = memchr(start, '\n', (size_t)(end - start));
+        const char *line_end = newline != NULL ? newline : end;
+        if (parse_record_line(start, line_end, &record)) {
+            apply_record(&record);
+            if (record.kind != 'C') records++;
+        }
+        start = line_end + 1;
+    }
+    return records;
+}
+
+static void parse_chunk(TextChunk *chunk) {
+    int capacity = 0;
+    const char *start = chunk->start;
+    TextRecord record;
+    while (start < chunk->end) {
+        const char *newline = memchr(start, '\n', (size_t)(chunk->end - start));
+        const char *line_end = newline != NULL ? newline : chunk->end;
+        if (parse_record_line(start, line_end, &record)) {
+            if (chunk->count == capacity) {
+                capacity = capacity ? capacity * 2 : 4096;
+                TextRecord *grown = realloc(chunk->records, (size_t)capacity * sizeof(TextRecord));
+                if (grown == NULL) {
+                    free(chunk->records);
+                    chunk->records = NULL;
+                    chunk->count = 0;
+                    return;
+                }
+                chunk->records = grown;
+            }
+            chunk->records[chunk->count++] = record;
+        }
+        start = line_end + 1;
+    }
+}
+
+static void* loader_main(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&loader.mutex);
+    while (true) {
+        while (loader.next < loader.chunk_count && loader.next >= loader.applied + loader.ahead) {
+            pthread_cond_wait(&loader.ready, &loader.mutex);
+        }
+        if (loader.next == loader.chunk_count) break;
+        TextChunk *chunk = &loader.chunks[loader.next++];
+        pthread_mutex_unlock(&loader.mutex);
+
+        parse_chunk(chunk);
+
+        pthread_mutex_lock(&loader.mutex);
+        chunk->parsed = true;
+        pthread_cond_broadcast(&loader.ready);
+    }
+    pthread_mutex_unlock(&loader.mutex);
+    return NULL;
+}
+
+// Applies the text records in [data, data + length). With drop_tail an unterminated last
+// line is a torn write and is left out. Returns the bytes covered (up to the last line
+// applied) and adds the U/R/D records applied to *records.
+static size_t load_text(const char *data, size_t length, bool drop_tail, long *records) {
+    const char *end = data + length;
+    if (drop_tail) {
+        while (end > data && end[-1] != '\n') end--;
+    }
+    size_t covered = (size_t)(end - data);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cores < 1 ? 1 : cores > TEXT_LOAD_THREADS ? TEXT_LOAD_THREADS : (int)cores;
+    int chunk_count = (int)((covered + TEXT_LOAD_CHUNK - 1) / TEXT_LOAD_CHUNK);
+    if (threads > chunk_count) threads = chunk_count;
+    TextChunk *chunks = threads > 1 ? calloc((size_t)chunk_count, sizeof(TextChunk)) : NULL;
+    pthread_t workers[TEXT_LOAD_THREADS];
+    int started = 0;
+    if (chunks != NULL) {
+        // every chunk but the first starts after the first newline at or past its nominal start
+        const char *start = data;
+        for (int i = 0; i < chunk_count; i++) {
+            const char *nominal = data + (size_t)(i + 1) * TEXT_LOAD_CHUNK;
+            const char *next = end;
+            if (nominal < end) {
+                const char *newline = memchr(nominal, '\n', (size_t)(end - nominal));
+                next = newline != NULL ? newline + 1 : end;
+            }
+            chunks[i].start = start < next ? start : next;
+            chunks[i].end = next;
+            start = next;
+        }
+        loader.chunks = chunks;
+        loader.chunk_count = chunk_count;
+        loader.next = loader.applied = 0;
+        loader.ahead = threads * 2;
+        while (started < threads && pthread_create(&workers[started], NULL, loader_main, NULL) == 0) started++;
+    }
+    if (started == 0) {
+        free(chunks);
+        *records += apply_text(data, end);
+        return covered;
+    }
+
+    for (int i = 0; i < chunk_count; i++) {
+        pthread_mutex_lock(&loader.mutex);
+        while (!chunks[i].parsed) pthread_cond_wait(&loader.ready, &loader.mutex);
+        pthread_mutex_unlock(&loader.mutex);
+
+        if (chunks[i].records == NULL) {
+            *records += apply_text(chunks[i].start, chunks[i].end);
+        }
+        for (int r = 0; r < chunks[i].count; r++) {
+            apply_record(&chunks[i].records[r]);
+            if (chunks[i].records[r].kind != 'C') (*records)++;
+        }
+        free(chunks[i].records);
+        chunks[i].records = NULL;
+
+        pthread_mutex_lock(&loader.mutex);
+        loader.applied++;
+        pthread_cond_broadcast(&loader.ready);
+        pthread_mutex_unlock(&loader.mutex);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    loader.chunks = NULL;
+    free(chunks);
+    return covered;
+}
+
+// Maps length bytes of fd read-only; NULL when empty or unmappable.
+static const char* map_text(int fd, size_t length) {
+    if (length == 0) return NULL;
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+    madvise(map, length, MADV_SEQUENTIAL);
+    return map;
+}
+
+// --- Snapshots ---
+// Loads a snapshot in either format into the empty store and sets data_format to match.
+// A missing file is an empty database; only a damaged binary file is an error.
+bool read_snapshot(const char* path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return true;
+    }
+
+    char magic[sizeof(BINARY_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0) {
+        struct stat st;
+        bool mapped = fstat(fileno(file), &st) == 0 && map_binary_snapshot(fileno(file), st.st_size);
+        fclose(file); // the mapping outlives the descriptor
+        data_format = FORMAT_BINARY;
+        return mapped;
+    }
+
+    data_format = FORMAT_TEXT;
+    struct stat st;
+    bool loaded = fstat(fileno(file), &st) == 0;
+    const char *text = loaded ? map_text(fileno(file), st.st_size) : NULL;
+    loaded = loaded && (text != NULL || st.st_size == 0);
+    if (text != NULL) {
+        long records = 0;
+        load_text(text, st.st_size, false, &records);
+        munmap((void*)text, st.st_size);
+    }
+    fclose(file);
+    return loaded;
+}
+
+// Writes an image to path and makes it durable; the caller renames it into place.
+static bool write_image(const char* path, DataFormat format, const StoreImage *image) {
+    static StatTimer timer = STAT_TIMER("write_snapshot");
+    uint64_t start = stats_begin();
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    bool written;
+    if (format == FORMAT_BINARY) {
+        written = write_binary_snapshot(file, image);
+    } else {
+        fprintf(file, "C|%ld\n", image->checkpoint_id);
+        for (int i = 0; i < image->users.count; i++) {
+            write_user_record(file, arena_at(&image->users, i));
+        }
+        for (int i = 0; i < image->donations.count; i++) {
+            write_donation_record(file, &image->users, image_donation(image, i));
+        }
+        written = !ferror(file);
+    }
+
+    written = fflush(file) == 0 && fsync(fileno(file)) == 0 && written;
+    long bytes = ftell(file);
+    written = fclose(file) == 0 && written;
+    if (!written) remove(path);
+    stats_end(&timer, start, written && bytes > 0 ? (uint64_t)bytes : 0);
+    return written;
+}
+
+// Writes the whole store to a temporary file and atomically renames it over path.
+bool write_snapshot(const char* path, DataFormat format, long checkpoint_id) {
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    StoreImage image;
+    image_of_store(&image, checkpoint_id);
+    if (!write_image(tmp_path, format, &image)) {
+        return false;
+    }
+    if (rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    sync_parent_dir(path);
+    return true;
+}
+
+// Converts a snapshot to the other format, e.g. to edit a binary database by hand or to
+// import a text export. The checkpoint id is kept so an existing journal still applies.
+int convert_data_file(const char* source, const char* destination) {
+    if (access(source, R_OK) != 0 || !read_snapshot(source)) {
+        fprintf(stderr, "No se pudo leer %s.\n", source);
+        return 1;
+    }
+
+    DataFormat target = data_format == FORMAT_BINARY ? FORMAT_TEXT : FORMAT_BINARY;
+    bool written = write_snapshot(destination, target, journal.checkpoint_id);
+    if (written) {
+        printf("%s -> %s (%s): %d usuarios, %d donaciones\n", source, destination,
+               target == FORMAT_BINARY ? "binario" : "texto", users.count, donations.count);
+    } else {
+        fprintf(stderr, "No se pudo escribir %s.\n", destination);
+    }
+    free_store();
+    return written ? 0 : 1;
+}
+
+// --- Checkpoints ---
+// A checkpoint folds the journal into a new snapshot in two steps:
+//  1. Write: the snapshot, from an image of the store taken at journal offset A, goes to a
+//     temporary file. This is the slow part and holds no lock; inserts keep going.
+//  2. Install, under the store lock: whatever was appended after A is carried over into a
+//     new journal "J|<id>|<carried bytes>", then the snapshot and the new journal are
+//     renamed into place. First a marker "K|<id>|<A>" is added to the old journal: if we
+//     crash between the two renames, the next load replays the old journal from A on top
+//     of the new snapshot.
+
+static void checkpoint_tmp_path(char *path, size_t size) {
+    snprintf(path, size, "%s.%d.tmp", DATA_FILE, (int)getpid());
+}
+
+static bool checkpoint_write(const StoreImage *image) {
+    char tmp_path[PATH_MAX];
+    checkpoint_tmp_path(tmp_path, sizeof(tmp_path));
+    return write_image(tmp_path, data_format, image);
+}
+
+// Copies journal bytes [from, to) into a new buffer.
+static char* journal_read_range(long from, long to) {
+    char *buffer = malloc(to - from + 1);
+    if (buffer == NULL) return NULL;
+    for (long done = 0; done < to - from;) {
+        ssize_t got = pread(fileno(journal.file), buffer + done, to - from - done, from + done);
+        if (got <= 0) {
+            free(buffer);
+            return NULL;
+        }
+        done += got;
+    }
+    return buffer;
+}
+
+// Step 2. Call with the store lock held. Gives up, dropping the written snapshot, if another
+// process checkpointed since the image was taken.
+static bool checkpoint_install(const StoreImage *image) {
+    char snapshot_tmp[PATH_MAX];
+    char journal_tmp[PATH_MAX];
+    checkpoint_tmp_path(snapshot_tmp, sizeof(snapshot_tmp));
+    snprintf(journal_tmp, sizeof(journal_tmp), "%s.tmp", JOURNAL_FILE);
+
+    int64_t published_id, published_length;
+    bool current = journal.file != NULL && journal.checkpoint_id == image->checkpoint_id - 1
+        && (!shared_read(&published_id, &published_length) || published_id == journal.checkpoint_id);
+    struct stat st;
+    if (!current || fflush(journal.file) != 0 || fstat(fileno(journal.file), &st) != 0) {
+        remove(snapshot_tmp);
+        return false;
+    }
+
+    // the tail to carry over, up to the last complete line
+    long end = st.st_size;
+    char *tail = journal_read_range(image->journal_offset, end);
+    if (tail == NULL) {
+        remove(snapshot_tmp);
+        return false;
+    }
+    long carried = end - image->journal_offset;
+    while (carried > 0 && tail[carried - 1] != '\n') carried--;
+
+    FILE *next = fopen(journal_tmp, "a+");
+    long header_length = 0;
+    bool installed = next != NULL
+        && ftruncate(fileno(journal.file), image->journal_offset + carried) == 0 // a torn line of a dead process
+        && fprintf(journal.file, "K|%ld|%ld\n", image->checkpoint_id, image->journal_offset) > 0
+        && fflush(journal.file) == 0 && fsync(fileno(journal.file)) == 0
+        && fprintf(next, "J|%ld|%ld\n", image->checkpoint_id, carried) > 0
+        && fflush(next) == 0 && (header_length = ftell(next)) > 0
+        && fwrite(tail, 1, carried, next) == (size_t)carried
+        && fflush(next) == 0 && fsync(fileno(next)) == 0
+        && rename(snapshot_tmp, DATA_FILE) == 0;
+    free(tail);
+    if (installed && rename(journal_tmp, JOURNAL_FILE) != 0) {
+        // the marker covers this: we keep appending to the old journal, and a load replays
+        // it from the marker's offset
+        installed = false;
+    }
+    if (!installed) {
+        if (next != NULL) fclose(next);
+        remove(journal_tmp);
+        remove(snapshot_tmp);
+        return false;
+    }
+    sync_parent_dir(DATA_FILE);
+    sync_parent_dir(JOURNAL_FILE);
+
+    // we may not have applied the whole tail yet; it continues at the same place in the copy
+    fclose(journal.file);
+    journal.file = next;
+    journal.offset = header_length + (journal.offset - image->journal_offset);
+    journal.checkpoint_id = image->checkpoint_id;
+    journal.records = journal.records > image->records ? journal.records - image->records : 0;
+    journal.unsynced = 0;
+    shared_publish(header_length + carried);
+    return true;
+}
+
+// --- Writer Thread ---
+// The interactive UI moves persistence to a background thread so no keypress waits for the
+// disk. Inserts still reach the journal right away (a write to the page cache under the
+// store lock, which keeps the journal in the same order as the store). The thread then:
+//  - group-commits them: one fsync covers every record appended since the previous one,
+//    and the records that asked for it are acknowledged (persist_notify);
+//  - hands checkpoints to a second thread, which writes them from a frozen image and takes
+//    the store lock only to install them. A large snapshot takes long enough to write that
+//    the fsyncs can't wait behind it.
+// At most PERSIST_QUEUE_SIZE records wait for their fsync; past that, inserts wait.
+// Without the thread (headless commands, benchmarks) everything stays synchronous.
+
+typedef struct {
+    long ticket; // acknowledged once this many records are durable
+    PersistCallback callback;
+    void *context;
+} PersistAck;
+
+static struct {
+    pthread_t thread;
+    pthread_t checkpointer;
+    bool running;
+    bool stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;     // work for the threads
+    pthread_cond_t progress; // an fsync or a checkpoint finished
+    long appended;           // records written to the journal so far
+    long durable;            // records known to be on disk
+    StoreImage *checkpoint;  // waiting for, or being written by, the checkpointer
+    PersistAck acks[PERSIST_QUEUE_SIZE];
+    int ack_head;
+    int ack_count;
+    int event_pipe[2];       // a byte in it wakes the UI's event loop for persist_poll
+} writer = { .mutex = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .progress = PTHREAD_COND_INITIALIZER,
+             .event_pipe = { -1, -1 } };
+
+static bool persist_running() {
+    return writer.running;
+}
+
+// The descriptor is duplicated under the store mutex, so a journal swap on another thread
+// can't close it in the middle of the fsync. Returns how far the journal is now durable.
+static long writer_sync_journal() {
+    pthread_once(&shared_once, shared_init);
+    pthread_mutex_lock(&shared.mutex);
+    int fd = journal.file != NULL ? dup(fileno(journal.file)) : -1;
+    long offset = journal.offset;
+    pthread_mutex_unlock(&shared.mutex);
+    if (fd < 0) return 0;
+    fsync(fd);
+    close(fd);
+    return offset;
+}
+
+static void* writer_main(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&writer.mutex);
+    while (true) {
+        while (!writer.stopping && writer.durable == writer.appended) {
+            pthread_cond_wait(&writer.wake, &writer.mutex);
+        }
+        if (writer.durable == writer.appended) break; // stopping, drained
+        long target = writer.appended;
+        pthread_mutex_unlock(&writer.mutex);
+
+        static StatTimer sync_timer = STAT_TIMER("journal_fsync");
+        static long synced = 0; // a checkpoint starts a new, shorter journal
+        uint64_t start = stats_begin();
+        long offset = writer_sync_journal();
+        stats_end(&sync_timer, start, offset >= synced ? (uint64_t)(offset - synced) : (uint64_t)offset);
+        synced = offset;
+
+        pthread_mutex_lock(&writer.mutex);
+        writer.durable = target;
+        if (writer.ack_count > 0 && writer.acks[writer.ack_head].ticket <= writer.durable && writer.event_pipe[1] >= 0) {
+            if (write(writer.event_pipe[1], "", 1) < 0) {} // full pipe: a wake-up is already pending
+        }
+        pthread_cond_broadcast(&writer.progress);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+    return NULL;
+}
+
+// Records appended while a checkpoint is written land in the old journal and are carried
+// over by the install, which fsyncs the copy, so the writer's fsyncs stay valid across it.
+static void* checkpointer_main(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&writer.mutex);
+    while (true) {
+        while (!writer.stopping && writer.checkpoint == NULL) {
+            pthread_cond_wait(&writer.wake, &writer.mutex);
+        }
+        if (writer.checkpoint == NULL) break; // stopping, drained
+        StoreImage *image = writer.checkpoint;
+        pthread_mutex_unlock(&writer.mutex);
+
+        static StatTimer checkpoint_timer = STAT_TIMER("checkpoint");
+        uint64_t start = stats_begin();
+        if (checkpoint_write(image)) {
+            shared_acquire();
+            checkpoint_install(image);
+            shared_release();
+        }
+        stats_end(&checkpoint_timer, start, 0);
+
+        pthread_mutex_lock(&writer.mutex);
+        image_release(image);
+        free(image);
+        writer.checkpoint = NULL;
+        pthread_cond_broadcast(&writer.progress);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+    return NULL;
+}
+
+static void persist_join() {
+    pthread_mutex_lock(&writer.mutex);
+    writer.stopping = true;
+    pthread_cond_broadcast(&writer.wake);
+    pthread_mutex_unlock(&writer.mutex);
+    pthread_join(writer.thread, NULL);
+}
+
+bool persist_start() {
+    if (writer.running) return true;
+    if (pipe(writer.event_pipe) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(writer.event_pipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(writer.event_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    } else {
+        writer.event_pipe[0] = writer.event_pipe[1] = -1; // callers fall back to polling
+    }
+    writer.stopping = false;
+    writer.running = pthread_create(&writer.thread, NULL, writer_main, NULL) == 0;
+    if (writer.running && pthread_create(&writer.checkpointer, NULL, checkpointer_main, NULL) != 0) {
+        persist_join();
+        writer.running = false;
+    }
+    return writer.running;
+}
+
+// Readable while acknowledgements wait for persist_poll, so an event loop can sleep in
+// poll() until then. -1 without the writer thread.
+int persist_event_fd() {
+    return writer.running ? writer.event_pipe[0] : -1;
+}
+
+// Called by journal_commit, with the store lock held, once a record reached the kernel.
+static void persist_committed() {
+    pthread_mutex_lock(&writer.mutex);
+    writer.appended++;
+    pthread_cond_broadcast(&writer.wake);
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+// Waits while the thread is a full queue behind. Only before taking the store lock: the
+// thread needs it to make progress.
+static void persist_throttle() {
+    if (!writer.running) return;
+    pthread_mutex_lock(&writer.mutex);
+    while (writer.appended - writer.durable >= PERSIST_QUEUE_SIZE) {
+        pthread_cond_wait(&writer.progress, &writer.mutex);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+static bool persist_checkpoint_pending() {
+    pthread_mutex_lock(&writer.mutex);
+    bool pending = writer.checkpoint != NULL;
+    pthread_mutex_unlock(&writer.mutex);
+    return pending;
+}
+
+static void persist_wait_checkpoint() {
+    pthread_mutex_lock(&writer.mutex);
+    while (writer.checkpoint != NULL) {
+        pthread_cond_wait(&writer.progress, &writer.mutex);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+// Hands a checkpoint to the checkpointer, one at a time. Called with the store lock held and
+// caught up, so the frozen image matches the journal up to journal.offset.
+static void checkpoint_request() {
+    if (persist_checkpoint_pending()) return;
+    StoreImage *image = malloc(sizeof(StoreImage));
+    if (image == NULL || !image_freeze(image, journal.checkpoint_id + 1)) {
+        free(image); // retried on a later insert
+        return;
+    }
+    pthread_mutex_lock(&writer.mutex);
+    writer.checkpoint = image;
+    pthread_cond_broadcast(&writer.wake);
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+// Asks for callback(context) once the last record appended is on disk. Callbacks run on the
+// UI thread, from persist_poll; without the writer thread, right away. Call it after
+// releasing the store lock.
+void persist_notify(PersistCallback callback, void *context) {
+    if (!writer.running) {
+        callback(context);
+        return;
+    }
+    pthread_mutex_lock(&writer.mutex);
+    while (writer.ack_count == PERSIST_QUEUE_SIZE) {
+        pthread_mutex_unlock(&writer.mutex);
+        persist_poll();
+        pthread_mutex_lock(&writer.mutex);
+        if (writer.ack_count == PERSIST_QUEUE_SIZE) pthread_cond_wait(&writer.progress, &writer.mutex);
+    }
+    int slot = (writer.ack_head + writer.ack_count++) % PERSIST_QUEUE_SIZE;
+    writer.acks[slot] = (PersistAck){ writer.appended, callback, context };
+    if (writer.durable >= writer.appended && writer.event_pipe[1] >= 0) {
+        // the thread got there first and won't wake the event loop for this one
+        if (write(writer.event_pipe[1], "", 1) < 0) {}
+    }
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+// Runs the callbacks of records that became durable.
+void persist_poll() {
+    PersistAck ready[PERSIST_QUEUE_SIZE];
+    int count = 0;
+    char wakeups[64];
+    while (writer.event_pipe[0] >= 0 && read(writer.event_pipe[0], wakeups, sizeof(wakeups)) > 0) {}
+    pthread_mutex_lock(&writer.mutex);
+    while (writer.ack_count > 0 && writer.acks[writer.ack_head].ticket <= writer.durable) {
+        ready[count++] = writer.acks[writer.ack_head];
+        writer.ack_head = (writer.ack_head + 1) % PERSIST_QUEUE_SIZE;
+        writer.ack_count--;
+    }
+    pthread_mutex_unlock(&writer.mutex);
+    for (int i = 0; i < count; i++) {
+        ready[i].callback(ready[i].context);
+    }
+}
+
+// Drains the threads on exit: every record is fsync'd and, if anything was journaled, a last
+// checkpoint folds it into the snapshot. Without them, checkpoints synchronously.
+void persist_stop() {
+    if (!writer.running) {
+        if (journal.records > 0) save_data();
+        return;
+    }
+    persist_wait_checkpoint();
+    store_lock();
+    if (journal.records > 0) checkpoint_request();
+    store_unlock();
+
+    persist_join();
+    pthread_join(writer.checkpointer, NULL);
+    writer.running = false;
+    persist_poll();
+    for (int i = 0; i < 2; i++) {
+        if (writer.event_pipe[i] >= 0) close(writer.event_pipe[i]);
+        writer.event_pipe[i] = -1;
+    }
+}
+
+// Checkpoint on the calling thread, for the headless commands and for when the journal
+// can't be written. A crash at any point leaves a loadable snapshot + journal pair.
+void save_data() {
+    static StatTimer timer = STAT_TIMER("save_data");
+    uint64_t start = stats_begin();
+    persist_wait_checkpoint(); // one at a time, they share the temporary file
+    store_lock(); // the snapshot must hold every process's records, not just ours
+    StoreImage image;
+    image_of_store(&image, journal.checkpoint_id + 1);
+    if (journal.file == NULL) {
+        // nothing to carry over: plain snapshot, then try a fresh journal
+        if (write_snapshot(DATA_FILE, data_format, image.checkpoint_id)) {
+            journal.checkpoint_id = image.checkpoint_id;
+            if (journal_reset()) shared_publish(journal.offset);
+        }
+    } else if (checkpoint_write(&image)) {
+        checkpoint_install(&image);
+    }
+    store_unlock();
+
+    struct stat st;
+    stats_end(&timer, start, start != 0 && stat(DATA_FILE, &st) == 0 ? (uint64_t)st.st_size : 0);
+}
+
+static bool replay_journal();
+
+// Loads the snapshot, replays the journal tail on top of it and builds the aggregates. Call
+// with the store lock held.
+static bool load_store() {
+    if (!read_snapshot(DATA_FILE)) {
+        return false;
+    }
+
+    bool recovered = replay_journal();
+    build_aggregates();
+    if (recovered) {
+        // the old journal is still in place: fold it in now so every process sees a
+        // snapshot and journal that match
+        shared_publish(journal.offset);
+        save_data();
+    }
+    return true;
+}
+
+// Loads under the store lock, so no other process can checkpoint between our snapshot
+// read and journal replay, then publishes where the journal ends (this also initializes a
+// fresh shared header).
+bool load_data() {
+    static StatTimer timer = STAT_TIMER("load_data");
+    uint64_t start = stats_begin();
+    shared_acquire();
+    bool loaded = load_store();
+    if (loaded) shared_publish(journal.offset);
+    shared_release();
+
+    // bytes read: the snapshot plus the journal we replayed
+    struct stat st;
+    uint64_t bytes = start != 0 && stat(DATA_FILE, &st) == 0 ? (uint64_t)st.st_size : 0;
+    stats_end(&timer, start, bytes + (journal.offset > 0 ? (uint64_t)journal.offset : 0));
+    return loaded;
+}
+
+// Finds where the journal continues after the snapshot: the last marker a checkpoint left
+// for checkpoint_id, or -1. Walks the mapped journal line by line like the loader, so long
+// records can't split a line and fake a marker; a torn last line doesn't count.
+static long find_checkpoint_marker(const char *text, size_t length, long checkpoint_id) {
+    const char *end = text + length;
+    long found = -1;
+    for (const char *line = text; line < end; ) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        if (newline == NULL) break;
+        const char *p = line + 2;
+        int64_t marker_id, offset;
+        if (newline - line > 2 && line[0] == 'K' && line[1] == '|'
+            && parse_integer(&p, newline, &marker_id) && p < newline && *p++ == '|'
+            && parse_integer(&p, newline, &offset) && marker_id == checkpoint_id) {
+            found = (long)offset;
+        }
+        line = newline + 1;
+    }
+    return found;
+}
+
+// Applies the journal tail on top of the freshly loaded snapshot. A torn last line from a
+// crash mid-append is dropped and cut off so new appends start on a clean line. Returns
+// true if the journal belongs to the previous snapshot, i.e. a checkpoint was interrupted
+// between installing the snapshot and the journal.
+static bool replay_journal() {
+    journal.file = fopen(JOURNAL_FILE, "r+");
+    if (journal.file == NULL) {
+        journal_reset();
+        return false;
+    }
+
+    char line[256];
+    long journal_id = -1;
+    long start = -1;
+    long valid_length = 0;
+    struct stat st;
+    const char *text = NULL;
+    if (fgets(line, sizeof(line), journal.file) && sscanf(line, "J|%ld", &journal_id) == 1
+        && fstat(fileno(journal.file), &st) == 0) {
+        text = map_text(fileno(journal.file), st.st_size);
+        if (journal_id == journal.checkpoint_id) {
+            start = ftell(journal.file);
+        } else if (text != NULL) {
+            start = find_checkpoint_marker(text, st.st_size, journal.checkpoint_id);
+        }
+    }
+    if (start > 0 && start <= st.st_size) {
+        valid_length = start;
+        if (text != NULL) {
+            long records = 0;
+            valid_length += load_text(text + start, st.st_size - start, true, &records);
+            journal.records += records;
+        }
+    }
+    if (text != NULL) munmap((void*)text, st.st_size);
+
+    if (valid_length == 0 || ftruncate(fileno(journal.file), valid_length) != 0) {
+        // stale or unreadable journal: its records are already in the snapshot
+        journal_reset();
+        return false;
+    }
+
+    // reopen in append mode so every write lands at the end, even after other processes'
+    fclose(journal.file);
+    journal.file = fopen(JOURNAL_FILE, "a+");
+    journal.offset = valid_length;
+    journal.last_sync = time(NULL);
+    return journal_id != journal.checkpoint_id;
+}
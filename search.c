@@ -0,0 +1,374 @@
+/*
+ * File:        search.c
+ * Project:     Crucible
+ * Description: As-you-type user search: sorted indexes over control numbers and
+ *              accent-folded names, answered by prefix range lookups.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+UserSearch user_search = {
+    .ready = false,
+    .control = { .field = offsetof(User, control_number) },
+    .name = { .field = offsetof(User, name) },
+};
+
+// --- Folding ---
+// Second byte of the UTF-8 sequences C3 80..C3 BF (the Latin-1 letters) folded to the plain
+// lowercase letter, indexed by its low five bits so upper and lower case share one entry.
+// '.' means the letter has no plain equivalent and is kept as is.
+static const char latin1_fold[33] = "aaaaaa.ceeeeiiiidnooooo.ouuuuy..";
+
+// Lowercases text and strips accents so "Nunez", "NUÑEZ" and "núñez" compare equal.
+// Folding never makes text longer. Returns the folded length.
+size_t search_fold(const char *text, char *out, size_t size) {
+    const unsigned char *p = (const unsigned char*)text;
+    size_t length = 0;
+    while (*p && length + 1 < size) {
+        if (p[0] == 0xC3 && p[1] >= 0x80 && p[1] <= 0xBF && latin1_fold[p[1] & 0x1F] != '.') {
+            out[length++] = latin1_fold[p[1] & 0x1F];
+            p += 2;
+        } else {
+            out[length++] = (*p >= 'A' && *p <= 'Z') ? (char)(*p - 'A' + 'a') : (char)*p;
+            p++;
+        }
+    }
+    out[length] = '\0';
+    return length;
+}
+
+// First eight bytes of folded text, big-endian, so comparing keys orders like strcmp.
+static uint64_t folded_key(const char *folded) {
+    uint64_t key = 0;
+    int i = 0;
+    for (; i < 8 && folded[i]; i++) key = (key << 8) | (unsigned char)folded[i];
+    return key << (8 * (8 - i));
+}
+
+static const char* entry_text(const SearchIndex *index, int user) {
+    return (const char*)user_at(user) + index->field;
+}
+
+static SearchEntry make_entry(const SearchIndex *index, int user) {
+    char folded[MAX_NAME_LENGTH];
+    search_fold(entry_text(index, user), folded, sizeof(folded));
+    SearchEntry entry = { folded_key(folded), user };
+    return entry;
+}
+
+// --- Sorted Indexes ---
+// Each index is an array of users sorted by one folded field. Inserts go to an unsorted tail
+// that queries scan linearly; once it passes SEARCH_TAIL_MAX it is sorted and merged in, so
+// an insert costs a copy of the index only every SEARCH_TAIL_MAX users.
+
+// While an index is being built, every user's folded text is kept here so ties on the key
+// don't fold the same names again on each of the n log n comparisons.
+static char *build_text = NULL;
+static uint32_t *build_offset = NULL;
+
+static const char* folded_text(const SearchIndex *index, int user, char *buffer) {
+    if (build_text != NULL) return build_text + build_offset[user];
+    search_fold(entry_text(index, user), buffer, MAX_NAME_LENGTH);
+    return buffer;
+}
+
+static int compare_entries(const SearchIndex *index, const SearchEntry *a, const SearchEntry *b) {
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    char buffer_a[MAX_NAME_LENGTH], buffer_b[MAX_NAME_LENGTH];
+    int order = strcmp(folded_text(index, a->user, buffer_a), folded_text(index, b->user, buffer_b));
+    if (order != 0) return order;
+    return (a->user > b->user) - (a->user < b->user);
+}
+
+static int compare_by_control(const void *a, const void *b) {
+    return compare_entries(&user_search.control, a, b);
+}
+
+static int compare_by_name(const void *a, const void *b) {
+    return compare_entries(&user_search.name, a, b);
+}
+
+static void index_sort(const SearchIndex *index, SearchEntry *entries, size_t count) {
+    qsort(entries, count, sizeof(SearchEntry), index == &user_search.control ? compare_by_control : compare_by_name);
+}
+
+static bool index_grow(SearchIndex *index, int needed) {
+    if (needed <= index->capacity) return true;
+    int capacity = index->capacity ? index->capacity : 1024;
+    while (capacity < needed) capacity *= 2;
+    SearchEntry *grown = realloc(index->entries, capacity * sizeof(SearchEntry));
+    if (grown == NULL) return false;
+    index->entries = grown;
+    index->capacity = capacity;
+    return true;
+}
+
+// Sorts the tail and merges it into the sorted part, back to front so no second array is needed.
+static void index_merge_tail(SearchIndex *index) {
+    int tail_count = index->count - index->sorted;
+    SearchEntry tail[SEARCH_TAIL_MAX + 1];
+    memcpy(tail, index->entries + index->sorted, tail_count * sizeof(SearchEntry));
+    index_sort(index, tail, tail_count);
+
+    int i = index->sorted - 1, j = tail_count - 1, out = index->count - 1;
+    while (j >= 0) {
+        if (i >= 0 && compare_entries(index, &index->entries[i], &tail[j]) > 0) {
+            index->entries[out--] = index->entries[i--];
+        } else {
+            index->entries[out--] = tail[j--];
+        }
+    }
+    index->sorted = index->count;
+}
+
+static bool index_add(SearchIndex *index, int user) {
+    if (!index_grow(index, index->count + 1)) return false;
+    index->entries[index->count++] = make_entry(index, user);
+    if (index->count - index->sorted > SEARCH_TAIL_MAX) index_merge_tail(index);
+    return true;
+}
+
+static void index_free(SearchIndex *index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->count = index->sorted = index->capacity = 0;
+}
+
+// <0 if the entry sorts before every text starting with the prefix, 0 if it starts with it,
+// >0 if it sorts after them. Matches are therefore one contiguous run of the sorted part.
+static int compare_prefix(const SearchIndex *index, const SearchEntry *entry, const char *prefix,
+                          size_t length, uint64_t prefix_key) {
+    if (length < 8) {
+        uint64_t mask = length == 0 ? 0 : ~0ull << (8 * (8 - length));
+        uint64_t key = entry->key & mask;
+        return key == prefix_key ? 0 : (key < prefix_key ? -1 : 1);
+    }
+    if (entry->key != prefix_key) return entry->key < prefix_key ? -1 : 1;
+    char buffer[MAX_NAME_LENGTH];
+    return strncmp(folded_text(index, entry->user, buffer), prefix, length);
+}
+
+// First entry of the sorted part for which compare_prefix is >= (upper false) or > (upper true) 0.
+static int index_bound(const SearchIndex *index, const char *prefix, size_t length, uint64_t key, bool upper) {
+    int low = 0, high = index->sorted;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        int order = compare_prefix(index, &index->entries[mid], prefix, length, key);
+        if (order < 0 || (upper && order == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// --- Incremental Build ---
+// Building both indexes at once stalls for about a second at a million users, so the build
+// advances in steps of about SEARCH_BUILD_STEP entries that the UI runs while idle: fold
+// every user's text, sort runs of SEARCH_RUN entries, then merge the runs pairwise. Users
+// added meanwhile are inserted once both indexes are done.
+
+typedef enum { BUILD_FOLD, BUILD_SORT, BUILD_MERGE } BuildPhase;
+
+static struct {
+    SearchIndex *index;    // being built, NULL when no build is under way
+    BuildPhase phase;
+    int target;            // users [0, target) go through the steps
+    int next;              // next user to fold, run to sort or pair of runs to merge
+    int width;             // run length of the current merge pass
+    size_t used;           // bytes of build_text filled
+    SearchEntry *scratch;  // merge buffer
+} build;
+
+static void build_release() {
+    free(build_text);
+    free(build_offset);
+    free(build.scratch);
+    build_text = NULL;
+    build_offset = NULL;
+    build.scratch = NULL;
+    build.index = NULL;
+}
+
+static bool build_begin(SearchIndex *index) {
+    int count = build.target > 0 ? build.target : 1;
+    if (!index_grow(index, count)) return false;
+    if (build.scratch == NULL && (build.scratch = malloc(count * sizeof(SearchEntry))) == NULL) return false;
+
+    size_t limit = (size_t)count * MAX_NAME_LENGTH;
+    build_text = malloc(limit);
+    build_offset = malloc(count * sizeof(uint32_t));
+    if (build_text == NULL || build_offset == NULL || limit > UINT32_MAX) {
+        free(build_text); // sort folding on the fly, slower but needs no extra memory
+        free(build_offset);
+        build_text = NULL;
+        build_offset = NULL;
+    }
+    build.index = index;
+    build.phase = BUILD_FOLD;
+    build.next = 0;
+    build.used = 0;
+    return true;
+}
+
+// Merges the sorted runs [first, middle) and [middle, last) through the scratch buffer.
+static void merge_runs(const SearchIndex *index, int first, int middle, int last) {
+    SearchEntry *entries = index->entries;
+    int i = first, j = middle, out = first;
+    while (i < middle && j < last) {
+        if (compare_entries(index, &entries[j], &entries[i]) < 0) {
+            build.scratch[out++] = entries[j++];
+        } else {
+            build.scratch[out++] = entries[i++];
+        }
+    }
+    while (i < middle) build.scratch[out++] = entries[i++];
+    while (j < last) build.scratch[out++] = entries[j++];
+    memcpy(entries + first, build.scratch + first, (last - first) * sizeof(SearchEntry));
+}
+
+// Moves on to the name index once the control index is sorted, or finishes the build.
+static bool build_finish_index() {
+    SearchIndex *index = build.index;
+    index->count = index->sorted = build.target;
+    free(build_text);
+    free(build_offset);
+    build_text = NULL;
+    build_offset = NULL;
+    if (index == &user_search.control) return build_begin(&user_search.name);
+
+    build_release();
+    user_search.ready = true;
+    for (int i = build.target; i < users.count && user_search.ready; i++) search_add_user(i);
+    return true;
+}
+
+// Does one step of the build. Returns true once there is nothing left to do: the indexes
+// are ready, or memory ran out (search_enable then reports the failure).
+bool search_build_step() {
+    if (user_search.ready) return true;
+    if (build.index == NULL) {
+        build.target = users.count;
+        if (!build_begin(&user_search.control)) {
+            search_free();
+            return true;
+        }
+    }
+
+    SearchIndex *index = build.index;
+    int end = build.target - build.next > SEARCH_BUILD_STEP ? build.next + SEARCH_BUILD_STEP : build.target;
+    bool ok = true;
+    switch (build.phase) {
+        case BUILD_FOLD:
+            for (int i = build.next; i < end; i++) {
+                if (build_text == NULL) {
+                    index->entries[i] = make_entry(index, i);
+                    continue;
+                }
+                build_offset[i] = (uint32_t)build.used;
+                build.used += search_fold(entry_text(index, i), build_text + build.used, MAX_NAME_LENGTH) + 1;
+                index->entries[i] = (SearchEntry){ folded_key(build_text + build_offset[i]), i };
+            }
+            build.next = end;
+            if (end == build.target) {
+                build.phase = BUILD_SORT;
+                build.next = 0;
+            }
+            break;
+        case BUILD_SORT:
+            for (int run = build.next; run < end; run += SEARCH_RUN) {
+                index_sort(index, index->entries + run, end - run < SEARCH_RUN ? end - run : SEARCH_RUN);
+            }
+            build.next = end;
+            if (end == build.target) {
+                build.phase = BUILD_MERGE;
+                build.width = SEARCH_RUN;
+                build.next = 0;
+            }
+            break;
+        case BUILD_MERGE:
+            if (build.width >= build.target) {
+                ok = build_finish_index();
+                break;
+            }
+            for (int merged = 0; merged < SEARCH_BUILD_STEP && build.next < build.target; ) {
+                int first = build.next;
+                int middle = build.target - first > build.width ? first + build.width : build.target;
+                int last = build.target - middle > build.width ? middle + build.width : build.target;
+                if (middle < last) merge_runs(index, first, middle, last);
+                merged += last - first;
+                build.next = last;
+            }
+            if (build.next == build.target) {
+                build.width = build.width > INT32_MAX / 2 ? INT32_MAX : build.width * 2;
+                build.next = 0;
+            }
+            break;
+    }
+    if (!ok) search_free();
+    return build.index == NULL;
+}
+
+// --- Search ---
+// Builds both indexes, finishing whatever idle steps left over. Called lazily by the search
+// view; add_user keeps them current after.
+bool search_enable() {
+    while (!search_build_step()) {}
+    return user_search.ready;
+}
+
+void search_add_user(int user) {
+    if (!index_add(&user_search.control, user) || !index_add(&user_search.name, user)) {
+        search_free(); // out of memory: rebuilt on the next search_enable
+    }
+}
+
+void search_free() {
+    build_release();
+    index_free(&user_search.control);
+    index_free(&user_search.name);
+    user_search.ready = false;
+}
+
+// Finds users whose control number (queries starting with a digit) or name (anything else)
+// starts with query, ignoring case and accents. An empty query lists everyone by name.
+// The result points into the index and is only valid until the next insert.
+bool search_users(const char *query, SearchResult *result) {
+    result->total = result->run = result->tail_count = 0;
+    if (!search_enable()) return false;
+
+    char prefix[MAX_NAME_LENGTH];
+    size_t length = search_fold(query, prefix, sizeof(prefix));
+    const SearchIndex *index = (prefix[0] >= '0' && prefix[0] <= '9') ? &user_search.control : &user_search.name;
+    uint64_t key = folded_key(prefix);
+
+    result->index = index;
+    result->first = index_bound(index, prefix, length, key, false);
+    result->run = index_bound(index, prefix, length, key, true) - result->first;
+
+    SearchEntry matches[SEARCH_TAIL_MAX];
+    int count = 0;
+    for (int i = index->sorted; i < index->count; i++) {
+        if (compare_prefix(index, &index->entries[i], prefix, length, key) == 0) matches[count++] = index->entries[i];
+    }
+    index_sort(index, matches, count);
+    for (int i = 0; i < count; i++) result->tail[i] = matches[i].user;
+    result->tail_count = count;
+    result->total = result->run + count;
+    return true;
+}
+
+// User position of the row-th match: the sorted run first, then recent inserts.
+int search_result_user(const SearchResult *result, int row) {
+    if (row < result->run) return result->index->entries[result->first + row].user;
+    return result->tail[row - result->run];
+}
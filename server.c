@@ -0,0 +1,486 @@
+/*
+ * File:        server.c
+ * Project:     Crucible
+ * Description: Local socket server for the collection centers' submission terminals:
+ *              registrations and donations over a Unix domain socket, written through
+ *              the same store and journal as the kiosks.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crucible.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// --- Protocol ---
+// One request per line, in the journal's record syntax:
+//     U|numero_control|nombre
+//     R|centro|numero_control|nombre
+//     D|numero_control|papel|plastico|aluminio[|timestamp]
+// each answered, in order, with a line "OK" or "ERR <motivo>". Registering a control number
+// that exists is OK (the first name wins, as in import); a donation needs a registered user.
+// U registers at the server's own center (--centro), R at the given one.
+// timestamp is epoch seconds, 0 for undated; without it the donation is dated on arrival.
+//
+// Clients may pipeline as many requests as they like. Each round of the loop handles what
+// every ready client sent under one store lock, then asks the writer thread for one fsync
+// for all of it; the round's answers go out, one write per client, once that fsync is done.
+// An OK is therefore durable, and the next round is handled while the disk works.
+
+#define SERVER_LISTENER SERVER_MAX_CLIENTS
+#define SERVER_PERSIST (SERVER_MAX_CLIENTS + 1)
+
+typedef struct {
+    uint64_t round;
+    size_t end; // answers up to here go out once round is on disk
+} HeldAnswers;
+
+typedef struct {
+    int fd;
+    uint32_t events;        // what epoll watches for it
+    bool touched;           // handled a request this round
+    bool discarding;        // skipping the rest of an overlong line
+    bool closing;           // the client is done sending; close once answered
+    char in[SERVER_INPUT_BUFFER];
+    size_t in_length;
+    char *out;
+    size_t out_length;      // answers written
+    size_t out_released;    // answers whose records are on disk
+    size_t out_sent;
+    size_t out_capacity;
+    HeldAnswers held[SERVER_PENDING_ROUNDS];
+    int held_head;
+    int held_count;
+} Client;
+
+static struct {
+    int epoll_fd;
+    int listen_fd;
+    Client *clients[SERVER_MAX_CLIENTS];
+    int touched[SERVER_MAX_CLIENTS];
+    int touched_count;
+    uint64_t round;
+    int round_records;      // journaled this round
+    int64_t round_time;     // arrival date of this round's donations
+    long connections, new_users, new_donations, rejected;
+} server;
+
+static volatile sig_atomic_t server_stopping = 0;
+
+static void server_signal(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+// --- Clients ---
+static void client_close(int slot) {
+    Client *client = server.clients[slot];
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->out);
+    free(client);
+    server.clients[slot] = NULL;
+}
+
+static bool client_can_read(const Client *client) {
+    return !client->closing && client->held_count < SERVER_PENDING_ROUNDS
+        && client->out_length - client->out_sent < SERVER_OUTPUT_MAX;
+}
+
+// Reads only while the client keeps up with its answers, so one that stops reading can't
+// make us buffer without limit; writes only while released answers wait.
+static void client_watch(int slot) {
+    Client *client = server.clients[slot];
+    uint32_t events = (client_can_read(client) ? EPOLLIN : 0) | (client->out_sent < client->out_released ? EPOLLOUT : 0);
+    if (events == client->events) return;
+    struct epoll_event event = { .events = events, .data.u32 = (uint32_t)slot };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    client->events = events;
+}
+
+// Sends released answers, as much as the socket takes. Returns false if the client is gone.
+static bool client_flush(int slot) {
+    Client *client = server.clients[slot];
+    while (client->out_sent < client->out_released) {
+        ssize_t sent = send(client->fd, client->out + client->out_sent, client->out_released - client->out_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (sent <= 0) {
+            client_close(slot);
+            return false;
+        }
+        client->out_sent += (size_t)sent;
+    }
+
+    // slide what's left to the front; held marks move with it
+    if (client->out_sent > 0) {
+        size_t shift = client->out_sent;
+        memmove(client->out, client->out + shift, client->out_length - shift);
+        client->out_length -= shift;
+        client->out_released -= shift;
+        client->out_sent = 0;
+        for (int i = 0; i < client->held_count; i++) {
+            client->held[(client->held_head + i) % SERVER_PENDING_ROUNDS].end -= shift;
+        }
+    }
+    if (client->closing && client->out_length == 0) {
+        client_close(slot);
+        return false;
+    }
+    client_watch(slot);
+    return true;
+}
+
+static bool client_answer(Client *client, const char *answer) {
+    size_t length = strlen(answer);
+    if (client->out_length + length + 1 > client->out_capacity) {
+        size_t capacity = client->out_capacity > 0 ? client->out_capacity * 2 : 4096;
+        while (capacity < client->out_length + length + 1) capacity *= 2;
+        char *out = realloc(client->out, capacity);
+        if (out == NULL) return false;
+        client->out = out;
+        client->out_capacity = capacity;
+    }
+    memcpy(client->out + client->out_length, answer, length);
+    client->out[client->out_length + length] = '\n';
+    client->out_length += length + 1;
+    return true;
+}
+
+static void accept_clients() {
+    while (true) {
+        int fd = accept(server.listen_fd, NULL, NULL);
+        if (fd < 0) return; // EAGAIN, or out of descriptors: the rest wait in the backlog
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        int slot = 0;
+        while (slot < SERVER_MAX_CLIENTS && server.clients[slot] != NULL) slot++;
+        Client *client = slot < SERVER_MAX_CLIENTS ? calloc(1, sizeof(Client)) : NULL;
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = (uint32_t)slot };
+        if (client == NULL || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            free(client);
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->events = EPOLLIN;
+        server.clients[slot] = client;
+        server.connections++;
+    }
+}
+
+// --- Requests ---
+// Handles one request line in place; called with the store lock held.
+static const char* handle_request(char *line) {
+    char *fields[7];
+    int count = 0;
+    for (char *field = line; count < 7; count++) {
+        fields[count] = field;
+        field = strchr(field, '|');
+        if (field == NULL) {
+            count++;
+            break;
+        }
+        *field++ = '\0';
+    }
+
+    bool registration = count == 3 && strcmp(fields[0], "U") == 0;
+    int center = shards.home;
+    if (count == 4 && strcmp(fields[0], "R") == 0) {
+        char *end;
+        long parsed = strtol(fields[1], &end, 10);
+        if (end == fields[1] || *end != '\0' || parsed < 0 || parsed >= MAX_CENTERS) return "ERR centro invalido";
+        center = (int)parsed;
+        registration = true;
+        fields[1] = fields[2];
+        fields[2] = fields[3];
+    }
+
+    if (registration) {
+        if (!valid_text_field(fields[1], MAX_CONTROL_NUMBER_LENGTH) || !valid_text_field(fields[2], MAX_NAME_LENGTH)) {
+            return "ERR numero de control o nombre invalido";
+        }
+        if (find_user(fields[1]) != NULL) return "OK";
+        User *user = add_user_at(fields[1], fields[2], center);
+        if (user == NULL) return "ERR sin memoria";
+        journal_append_user(user);
+        server.new_users++;
+        server.round_records++;
+        return "OK";
+    }
+
+    if ((count == 5 || count == 6) && strcmp(fields[0], "D") == 0) {
+        int paper, plastic, aluminum;
+        if (!parse_quantity(fields[2], &paper) || !parse_quantity(fields[3], &plastic)
+            || !parse_quantity(fields[4], &aluminum)) {
+            return "ERR cantidad invalida";
+        }
+        int64_t timestamp = server.round_time;
+        if (count == 6) {
+            char *end;
+            long long parsed = strtoll(fields[5], &end, 10);
+            if (end == fields[5] || *end != '\0' || parsed < 0) return "ERR fecha invalida";
+            timestamp = parsed;
+        }
+        if (find_user(fields[1]) == NULL) return "ERR usuario no registrado";
+        Donation *donation = add_donation(fields[1], paper, plastic, aluminum, timestamp);
+        if (donation == NULL) return "ERR sin memoria";
+        journal_append_donation(donation);
+        server.new_donations++;
+        server.round_records++;
+        return "OK";
+    }
+    return "ERR formato";
+}
+
+// Reads what the client sent, once, and handles every complete line. Returns false if the
+// client is gone.
+static bool client_read(int slot) {
+    Client *client = server.clients[slot];
+    ssize_t received = read(client->fd, client->in + client->in_length, sizeof(client->in) - client->in_length);
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+        client_close(slot);
+        return false;
+    }
+    if (received == 0) {
+        client->closing = true; // answer what it sent, then close
+        client->in_length = 0;
+    }
+    client->in_length += (size_t)received;
+
+    char *line = client->in;
+    char *end = client->in + client->in_length;
+    char *newline;
+    while ((newline = memchr(line, '\n', (size_t)(end - line))) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+        if (client->discarding) {
+            client->discarding = false;
+        } else if (line[0] != '\0') {
+            const char *answer = handle_request(line);
+            if (answer[0] == 'E') server.rejected++;
+            if (!client_answer(client, answer)) {
+                client_close(slot);
+                return false;
+            }
+            if (!client->touched) {
+                client->touched = true;
+                server.touched[server.touched_count++] = slot;
+            }
+        }
+        line = newline + 1;
+    }
+    client->in_length = (size_t)(end - line);
+    memmove(client->in, line, client->in_length);
+    if (client->closing) return client_flush(slot); // stop watching for input
+
+    if (client->in_length == sizeof(client->in)) {
+        // no newline in a full buffer: refuse the line and skip up to its end
+        client->in_length = 0;
+        if (!client->discarding) {
+            client->discarding = true;
+            server.rejected++;
+            if (!client_answer(client, "ERR linea demasiado larga")) {
+                client_close(slot);
+                return false;
+            }
+            if (!client->touched) {
+                client->touched = true;
+                server.touched[server.touched_count++] = slot;
+            }
+        }
+    }
+    return true;
+}
+
+// --- Group Commit ---
+// Releases the answers of every round up to the one whose records just reached the disk.
+static void round_durable(void *context) {
+    uint64_t round = (uint64_t)(uintptr_t)context;
+    for (int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+        Client *client = server.clients[slot];
+        if (client == NULL || client->held_count == 0) continue;
+        while (client->held_count > 0 && client->held[client->held_head].round <= round) {
+            client->out_released = client->held[client->held_head].end;
+            client->held_head = (client->held_head + 1) % SERVER_PENDING_ROUNDS;
+            client->held_count--;
+        }
+        client_flush(slot);
+    }
+}
+
+// Holds the round's answers until its records are on disk. Answers of a round that wrote
+// nothing only wait for the client's earlier ones.
+static void round_finish() {
+    for (int i = 0; i < server.touched_count; i++) {
+        int slot = server.touched[i];
+        Client *client = server.clients[slot];
+        if (client == NULL || !client->touched) continue; // closed, maybe the slot reused
+        client->touched = false;
+        if (server.round_records > 0) {
+            int last = (client->held_head + client->held_count) % SERVER_PENDING_ROUNDS;
+            client->held[last] = (HeldAnswers){ server.round, client->out_length };
+            client->held_count++;
+        } else if (client->held_count > 0) {
+            client->held[(client->held_head + client->held_count - 1) % SERVER_PENDING_ROUNDS].end = client->out_length;
+        } else {
+            client->out_released = client->out_length;
+            client_flush(slot);
+            continue;
+        }
+        client_watch(slot);
+    }
+    server.touched_count = 0;
+    if (server.round_records > 0) {
+        persist_notify(round_durable, (void *)(uintptr_t)server.round);
+    }
+    server.round++;
+}
+
+// --- Listening Socket ---
+// Binds path, replacing a stale socket left by a server that died, but not a live one.
+static int listen_socket(const char *path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Ruta de socket demasiado larga: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    bool bound = bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    if (!bound && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+        if (probe >= 0) close(probe);
+        if (live) {
+            fprintf(stderr, "Ya hay un servidor escuchando en %s.\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        bound = bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    }
+    if (!bound || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "No se pudo escuchar en %s.\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// --- Server Mode ---
+int run_server(const char* path) {
+    if (!load_data()) {
+        fprintf(stderr, "No se pudo leer %s: archivo danado o de otra version.\n", DATA_FILE);
+        return 1;
+    }
+    server.listen_fd = listen_socket(path);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.listen_fd < 0 || server.epoll_fd < 0) {
+        if (server.listen_fd >= 0) close(server.listen_fd);
+        if (server.epoll_fd >= 0) close(server.epoll_fd);
+        journal_close();
+        free_store();
+        return 1;
+    }
+    persist_start(); // the group commit: one fsync per round, off the loop
+
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = SERVER_LISTENER };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+    if (persist_event_fd() >= 0) {
+        event.data.u32 = SERVER_PERSIST;
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, persist_event_fd(), &event);
+    }
+
+    // SIGINT/SIGTERM only arrive inside epoll_pwait, so a stop is never missed between checks
+    sigset_t blocked, original, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &original);
+    waiting = original;
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+    struct sigaction action = { .sa_handler = server_signal };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Escuchando en %s (Ctrl+C para terminar).\n", path);
+    fflush(stdout);
+
+    static StatTimer round_timer = STAT_TIMER("server_round");
+    struct epoll_event events[SERVER_EVENTS];
+    while (!server_stopping) {
+        int ready = epoll_pwait(server.epoll_fd, events, SERVER_EVENTS, -1, &waiting);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        uint64_t start = stats_begin();
+        bool locked = false;
+        server.round_records = 0;
+        server.round_time = time(NULL);
+        for (int i = 0; i < ready; i++) {
+            uint32_t slot = events[i].data.u32;
+            if (slot == SERVER_LISTENER) {
+                accept_clients();
+            } else if (slot == SERVER_PERSIST) {
+                persist_poll();
+            } else if (server.clients[slot] != NULL) {
+                if ((events[i].events & EPOLLOUT) && !client_flush((int)slot)) continue;
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) && server.clients[slot]->closing) {
+                    client_close((int)slot); // gone both ways: nobody to answer
+                } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    if (!locked) {
+                        store_lock(); // also catches up with the kiosks' inserts
+                        locked = true;
+                    }
+                    client_read((int)slot);
+                }
+            }
+        }
+        if (locked) store_unlock();
+        round_finish();
+        if (locked) stats_end(&round_timer, start, 0);
+    }
+
+    // every OK already sent is durable; answers still held go out after the last fsync
+    close(server.listen_fd);
+    unlink(path);
+    persist_stop();
+    for (int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+        if (server.clients[slot] != NULL) client_close(slot);
+    }
+    close(server.epoll_fd);
+    sigprocmask(SIG_SETMASK, &original, NULL);
+    journal_close();
+    free_store();
+
+    printf("%ld conexiones, %ld usuarios nuevos, %ld donaciones, %ld solicitudes rechazadas\n",
+           server.connections, server.new_users, server.new_donations, server.rejected);
+    return 0;
+}
+
+#else
+
+int run_server(const char* path) {
+    (void)path;
+    fprintf(stderr, "El modo servidor solo esta disponible en Linux.\n");
+    return 1;
+}
+
+#endif
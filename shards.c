@@ -0,0 +1,82 @@
+/*
+ * File:        shards.c
+ * Project:     Crucible
+ * Description: Per-center shards of the donation table: which collection centers the
+ *              aggregates count and merging the others in when a view needs them.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <string.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+// Everything is counted unless the kiosk was started with --centro.
+Shards shards = { .home = 0, .all_loaded = true };
+
+// --- Shards ---
+// A binary snapshot stores the donations grouped by their donor's center, one section per
+// center and tier (see the Binary Snapshot section in persistence.c). A kiosk started for
+// one center builds its aggregates from that center's sections alone, so the rest of the
+// mapping is never faulted in and startup time and memory follow the size of one center.
+// Donations after the sections (the journal tail and new inserts) are checked one by one.
+// Reports over the whole network call shards_load_all first, which merges the missing
+// centers into the totals, the leaderboard and the timeline once.
+
+int donation_center(const Donation *donation) {
+    return user_at(donation->user)->center;
+}
+
+// Section covering position, which must be below shards.sectioned.
+static const ShardSection* section_at(int position) {
+    int low = 0, high = shards.section_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (shards.sections[mid].first <= (uint64_t)position) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return &shards.sections[low];
+}
+
+// First donation at or after position that belongs to a loaded center, donations.count if
+// there is none. Unloaded sections are stepped over whole.
+int shard_skip(int position) {
+    if (shards.all_loaded) return position;
+    while (position < donations.count) {
+        if (position >= shards.sectioned) {
+            if (shard_loaded(donation_center(donation_at(position)))) return position;
+            position++;
+            continue;
+        }
+        const ShardSection *section = section_at(position);
+        if (shard_loaded((int)section->center)) return position;
+        position = (int)(section->first + section->count);
+    }
+    return position;
+}
+
+// Counts every center from now on, merging the ones that weren't into the aggregates.
+void shards_load_all() {
+    if (shards.all_loaded) return;
+    static StatTimer timer = STAT_TIMER("shards_load_all");
+    uint64_t start = stats_begin();
+
+    bool missing[MAX_CENTERS];
+    for (int c = 0; c < MAX_CENTERS; c++) missing[c] = !shards.loaded[c];
+    if (aggregates.ready) {
+        for (int s = 0; s < shards.section_count; s++) {
+            const ShardSection *section = &shards.sections[s];
+            if (missing[section->center]) aggregate_range((int)section->first, (int)section->count, NULL);
+        }
+        aggregate_range(shards.sectioned, donations.count - shards.sectioned, missing);
+        rebuild_leaders();
+        timeline_merge();
+    }
+    shards.all_loaded = true;
+    stats_end(&timer, start, 0);
+}
@@ -0,0 +1,129 @@
+/*
+ * File:        stats.c
+ * Project:     Crucible
+ * Description: Lightweight instrumentation: named timers with latency histograms and byte
+ *              counters, read by the stats overlay and dumped as JSON by --stats.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+bool stats_enabled = false;
+
+// Timers register themselves the first time they record, appended so the overlay lists them
+// in the order they first ran. Readers walk the list without the mutex: a timer is fully
+// initialized before the release store that links it in.
+static StatTimer *stats_head = NULL;
+static StatTimer *stats_tail = NULL;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Clock ---
+uint64_t stats_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+void stats_enable(bool enabled) {
+    stats_enabled = enabled;
+}
+
+// --- Histograms ---
+// Log-linear buckets: values below 16 ns get one bucket each, above that every power of two
+// is split in four, so a percentile is off by at most 12.5% and 256 buckets cover any uint64.
+static int bucket_of(uint64_t value) {
+    if (value < 16) return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exponent - 2)) & 3;
+    return 16 + (exponent - 4) * 4 + sub;
+}
+
+// Middle of the range of values that fall in bucket.
+static uint64_t bucket_value(int bucket) {
+    if (bucket < 16) return (uint64_t)bucket;
+    int exponent = (bucket - 16) / 4 + 4;
+    uint64_t step = 1ull << (exponent - 2);
+    return (uint64_t)(4 + (bucket - 16) % 4) * step + step / 2;
+}
+
+static void stats_register(StatTimer *timer) {
+    pthread_mutex_lock(&stats_mutex);
+    if (!timer->registered) {
+        timer->registered = true;
+        if (stats_tail == NULL) {
+            __atomic_store_n(&stats_head, timer, __ATOMIC_RELEASE);
+        } else {
+            __atomic_store_n(&stats_tail->next, timer, __ATOMIC_RELEASE);
+        }
+        stats_tail = timer;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+// Counts one event of elapsed nanoseconds that moved bytes. Safe from any thread; the
+// writer thread records checkpoints while the UI records frames.
+void stats_record(StatTimer *timer, uint64_t elapsed, uint64_t bytes) {
+    if (!__atomic_load_n(&timer->registered, __ATOMIC_ACQUIRE)) stats_register(timer);
+    __atomic_fetch_add(&timer->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&timer->total_ns, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&timer->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&timer->buckets[bucket_of(elapsed)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&timer->max_ns, __ATOMIC_RELAXED);
+    while (elapsed > max && !__atomic_compare_exchange_n(&timer->max_ns, &max, elapsed, true,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Latency below which a fraction q (0..1) of the events fall (nearest rank), capped at the
+// observed maximum.
+uint64_t stats_percentile(const StatTimer *timer, double q) {
+    uint64_t counts[STATS_BUCKETS], total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        counts[i] = __atomic_load_n(&timer->buckets[i], __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+    if (total == 0) return 0;
+
+    double exact = q * (double)total;
+    uint64_t rank = (uint64_t)exact, seen = 0;
+    if (rank < exact || rank == 0) rank++;
+    uint64_t max = __atomic_load_n(&timer->max_ns, __ATOMIC_RELAXED);
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+// --- Reports ---
+const StatTimer* stats_first() {
+    return __atomic_load_n(&stats_head, __ATOMIC_ACQUIRE);
+}
+
+const StatTimer* stats_next(const StatTimer *timer) {
+    return __atomic_load_n(&timer->next, __ATOMIC_ACQUIRE);
+}
+
+// One object per timer that ran, times in nanoseconds.
+void stats_write_json(FILE *file) {
+    fprintf(file, "{\"timers\": [");
+    for (const StatTimer *timer = stats_first(); timer != NULL; timer = stats_next(timer)) {
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"count\": %llu, \"total_ns\": %llu, \"p50_ns\": %llu, "
+                "\"p99_ns\": %llu, \"max_ns\": %llu, \"bytes\": %llu}",
+                timer == stats_first() ? "" : ",", timer->name,
+                (unsigned long long)timer->count, (unsigned long long)timer->total_ns,
+                (unsigned long long)stats_percentile(timer, 0.50),
+                (unsigned long long)stats_percentile(timer, 0.99),
+                (unsigned long long)timer->max_ns, (unsigned long long)timer->bytes);
+    }
+    fprintf(file, "\n]}\n");
+}
@@ -0,0 +1,202 @@
+/*
+ * File:        store.c
+ * Project:     Crucible
+ * Description: Growable record storage for users and donations and the hash index
+ *              over control numbers.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "crucible.h"
+
+// --- Global State ---
+RecordArena users = ARENA_INIT(User);
+RecordArena donations = ARENA_INIT(Donation);
+UserIndex user_index = { NULL, 0, 0, false };
+
+// --- Record Store ---
+// Returns a zeroed slot at the end of the arena, or NULL if we ran out of memory.
+void* arena_push(RecordArena *arena) {
+    int chunk = (arena->count - arena->base_count) >> ARENA_CHUNK_SHIFT;
+    if (chunk == arena->chunk_count) {
+        if (arena->chunk_count == arena->chunk_capacity) {
+            int new_capacity = arena->chunk_capacity ? arena->chunk_capacity * 2 : 16;
+            char **grown = realloc(arena->chunks, new_capacity * sizeof(char*));
+            if (grown == NULL) return NULL;
+            arena->chunks = grown;
+            arena->chunk_capacity = new_capacity;
+        }
+        char *block = calloc(ARENA_CHUNK_SIZE, arena->record_size);
+        if (block == NULL) return NULL;
+        arena->chunks[arena->chunk_count++] = block;
+    }
+    return arena_at(arena, arena->count++);
+}
+
+// Writes every record from base_first on, in order, as one contiguous run.
+bool arena_write(const RecordArena *arena, FILE *file) {
+    size_t based = (size_t)(arena->base_count - arena->base_first);
+    if (based > 0 && fwrite(arena->base, arena->record_size, based, file) != based) {
+        return false;
+    }
+    int remaining = arena->count - arena->base_count;
+    for (int i = 0; i < arena->chunk_count && remaining > 0; i++) {
+        int n = remaining < ARENA_CHUNK_SIZE ? remaining : ARENA_CHUNK_SIZE;
+        if (fwrite(arena->chunks[i], arena->record_size, n, file) != (size_t)n) return false;
+        remaining -= n;
+    }
+    return true;
+}
+
+void arena_free(RecordArena *arena) {
+    for (int i = 0; i < arena->chunk_count; i++) {
+        free(arena->chunks[i]);
+    }
+    free(arena->chunks);
+    arena->chunks = NULL;
+    arena->base = NULL;
+    arena->chunk_count = arena->chunk_capacity = arena->count = arena->base_first = arena->base_count = 0;
+}
+
+User* user_at(int i) {
+    return (User*)arena_at(&users, i);
+}
+
+// Reads through both tiers: the sealed donations come first (see cold.c). Read-only, since a
+// sealed donation is a copy in this thread's decode cache: it stays valid until the thread
+// has decoded COLD_CACHE_BLOCKS other blocks, so copy it before reading many more.
+const Donation* donation_at(int i) {
+    if (i < cold.count) return cold_donation(&cold, i);
+    return (const Donation*)arena_at(&donations, i);
+}
+
+// FNV-1a, plenty for short control numbers
+static uint32_t hash_key(const char* key) {
+    uint32_t h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void index_place(IndexSlot *slots, uint32_t capacity, uint32_t hash, int32_t user) {
+    uint32_t mask = capacity - 1;
+    uint32_t pos = hash & mask;
+    while (slots[pos].user != 0) pos = (pos + 1) & mask;
+    slots[pos].hash = hash;
+    slots[pos].user = user;
+}
+
+// Keeps the load factor under 70% so probe chains stay short.
+static bool index_reserve(UserIndex *index, uint32_t needed) {
+    if (index->capacity && needed * 10 < index->capacity * 7) return true;
+
+    uint32_t capacity = index->capacity ? index->capacity * 2 : INDEX_INITIAL_CAPACITY;
+    while (needed * 10 >= capacity * 7) capacity *= 2;
+
+    IndexSlot *slots = calloc(capacity, sizeof(IndexSlot));
+    if (slots == NULL) return false;
+    for (uint32_t i = 0; i < index->capacity; i++) {
+        if (index->slots[i].user != 0) {
+            index_place(slots, capacity, index->slots[i].hash, index->slots[i].user);
+        }
+    }
+    if (!index->mapped) free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    index->mapped = false;
+    return true;
+}
+
+// Position of the user in the store, or -1 if the control number isn't registered.
+int find_user_position(const char* control_number) {
+    if (user_index.count == 0) return -1;
+
+    uint32_t hash = hash_key(control_number);
+    uint32_t mask = user_index.capacity - 1;
+    for (uint32_t pos = hash & mask; user_index.slots[pos].user != 0; pos = (pos + 1) & mask) {
+        if (user_index.slots[pos].hash != hash) continue;
+        int position = user_index.slots[pos].user - 1;
+        if (strcmp(user_at(position)->control_number, control_number) == 0) return position;
+    }
+    return -1;
+}
+
+User* find_user(const char* control_number) {
+    int position = find_user_position(control_number);
+    return position < 0 ? NULL : user_at(position);
+}
+
+// Registers a new user at this kiosk's center. Returns the existing record if the control
+// number is taken, or NULL if memory ran out.
+User* add_user(const char* control_number, const char* name) {
+    return add_user_at(control_number, name, shards.home);
+}
+
+// Same as add_user, for a user registered at another center (loading records, the server).
+User* add_user_at(const char* control_number, const char* name, int center) {
+    User *user = find_user(control_number);
+    if (user != NULL) return user;
+    if (!index_reserve(&user_index, user_index.count + 1)) return NULL;
+
+    user = arena_push(&users);
+    if (user == NULL) return NULL;
+    snprintf(user->control_number, sizeof(user->control_number), "%s", control_number);
+    snprintf(user->name, sizeof(user->name), "%s", name);
+    user->center = (uint8_t)center;
+
+    index_place(user_index.slots, user_index.capacity, hash_key(user->control_number), users.count);
+    user_index.count++;
+    if (user_search.ready) search_add_user(users.count - 1);
+    return user;
+}
+
+// Records a donation by the user with control_number. A donor missing from the user table
+// (hand-edited text files) is registered without a name, so the donation keeps its owner.
+Donation* add_donation(const char* control_number, int paper, int plastic, int aluminum, int64_t timestamp) {
+    int user = find_user_position(control_number);
+    if (user < 0) {
+        if (add_user_at(control_number, "", 0) == NULL) return NULL;
+        user = users.count - 1;
+    }
+    Donation *donation = arena_push(&donations);
+    if (donation == NULL) return NULL;
+    donation->user = (uint32_t)user;
+    donation->paper = paper;
+    donation->plastic = plastic;
+    donation->aluminum = aluminum;
+    donation->timestamp = timestamp;
+    if (aggregates.ready && shard_loaded(user_at(user)->center)) {
+        aggregate_donation(donation);
+        user_history_append(user, donations.count - 1);
+        timeline_add(donation, donations.count - 1);
+    }
+    if (columns.enabled) columns_append(donation);
+    return donation;
+}
+
+void free_store() {
+    free_aggregates();
+    columns_free();
+    search_free();
+    arena_free(&users);
+    arena_free(&donations);
+    cold_free();
+    if (!user_index.mapped) free(user_index.slots);
+    user_index.slots = NULL;
+    user_index.capacity = user_index.count = 0;
+    user_index.mapped = false;
+    shards.sections = NULL; // which centers are loaded carries over to a reload
+    shards.section_count = shards.sectioned = 0;
+    if (snapshot_map != NULL) {
+        munmap(snapshot_map, snapshot_map_length);
+        snapshot_map = NULL;
+        snapshot_map_length = 0;
+    }
+}
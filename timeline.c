@@ -0,0 +1,411 @@
+/*
+ * File:        timeline.c
+ * Project:     Crucible
+ * Description: Donation timestamps: daily, weekly and monthly rollups per material,
+ *              the time-ordered donation index and date-range queries over both.
+ * Author:      3 Lil Putos Inc. & Chato's Crew Development Team
+ *
+ * License:     BSD License (see main.c)
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crucible.h"
+
+// --- Calendar ---
+// Day numbers count local calendar days since 1970-01-01, so "today" and "this month" mean
+// what the kiosk's clock says. Conversions between day numbers and dates use Howard
+// Hinnant's civil-from-days algorithms, which need no tables and no time zone.
+
+static int floor_div(int a, int b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static int days_from_civil(int year, int month, int mday) {
+    year -= month <= 2;
+    int era = floor_div(year, 400);
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+void timeline_date(int day, int *year, int *month, int *mday) {
+    day += 719468;
+    int era = floor_div(day, 146097);
+    int day_of_era = day - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int mp = (5 * day_of_year + 2) / 153;
+    *mday = day_of_year - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+// Local midnight starting the day (or the first instant of it, where DST skips midnight).
+int64_t timeline_day_start(int day) {
+    struct tm local;
+    memset(&local, 0, sizeof(local));
+    timeline_date(day, &local.tm_year, &local.tm_mon, &local.tm_mday);
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1;
+    return (int64_t)mktime(&local);
+}
+
+// Donations mostly arrive in time order, so the day of the previous call is remembered and
+// localtime only runs when a timestamp falls outside it.
+static struct {
+    int64_t start;
+    int64_t end;
+    int day;
+} day_cache = { 1, 0, 0 };
+
+int timeline_day(int64_t timestamp) {
+    if (timestamp >= day_cache.start && timestamp < day_cache.end) return day_cache.day;
+
+    time_t t = (time_t)timestamp;
+    struct tm local;
+    if (localtime_r(&t, &local) == NULL) return 0;
+    int day = days_from_civil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+    day_cache.start = timeline_day_start(day);
+    day_cache.end = timeline_day_start(day + 1);
+    day_cache.day = day;
+    return day;
+}
+
+// Number of the period holding day: the day itself, weeks since the Monday 1969-12-29,
+// or year * 12 + month - 1.
+int timeline_period(Period period, int day) {
+    switch (period) {
+        case PERIOD_WEEK:
+            return floor_div(day + 3, 7);
+        case PERIOD_MONTH: {
+            int year, month, mday;
+            timeline_date(day, &year, &month, &mday);
+            return year * 12 + month - 1;
+        }
+        default:
+            return day;
+    }
+}
+
+// First day of a period number.
+int timeline_period_start(Period period, int number) {
+    switch (period) {
+        case PERIOD_WEEK:  return number * 7 - 3;
+        case PERIOD_MONTH: return days_from_civil(floor_div(number, 12), number - floor_div(number, 12) * 12 + 1, 1);
+        default:           return number;
+    }
+}
+
+// --- Rollups ---
+// One bucket per period between the oldest and newest dated donation, grown at either end.
+// Updated on every insert, so a report over whole periods never touches the donations.
+
+static void add_to_bucket(RollupBucket *bucket, const Donation *donation) {
+    bucket->totals.kg[MATERIAL_PAPER] += donation->paper;
+    bucket->totals.kg[MATERIAL_PLASTIC] += donation->plastic;
+    bucket->totals.kg[MATERIAL_ALUMINUM] += donation->aluminum;
+    bucket->count++;
+}
+
+static void merge_bucket(RollupBucket *into, const RollupBucket *from) {
+    for (int m = 0; m < MATERIAL_COUNT; m++) into->totals.kg[m] += from->totals.kg[m];
+    into->count += from->count;
+}
+
+// Bucket for a period number, growing the rollup to reach it. NULL if out of memory.
+static RollupBucket* rollup_slot(Rollup *rollup, int number) {
+    if (number >= rollup->first && number < rollup->first + rollup->count) {
+        return &rollup->buckets[number - rollup->first];
+    }
+    if (rollup->count == 0) rollup->first = number;
+    int shift = number < rollup->first ? rollup->first - number : 0;
+    int needed = shift > 0 ? rollup->count + shift : number - rollup->first + 1;
+    if (needed < rollup->count) needed = rollup->count;
+
+    if (needed > rollup->capacity) {
+        int capacity = rollup->capacity ? rollup->capacity : 64;
+        while (capacity < needed) capacity *= 2;
+        RollupBucket *grown = realloc(rollup->buckets, capacity * sizeof(RollupBucket));
+        if (grown == NULL) return NULL;
+        rollup->buckets = grown;
+        rollup->capacity = capacity;
+    }
+    if (shift > 0) {
+        memmove(rollup->buckets + shift, rollup->buckets, rollup->count * sizeof(RollupBucket));
+        memset(rollup->buckets, 0, shift * sizeof(RollupBucket));
+        rollup->first = number;
+    } else if (needed > rollup->count) {
+        memset(rollup->buckets + rollup->count, 0, (needed - rollup->count) * sizeof(RollupBucket));
+    }
+    rollup->count = needed;
+    return &rollup->buckets[number - rollup->first];
+}
+
+static const RollupBucket* rollup_bucket(const Rollup *rollup, int number) {
+    if (number < rollup->first || number >= rollup->first + rollup->count) return NULL;
+    return &rollup->buckets[number - rollup->first];
+}
+
+// Adds a dated donation to its day, week and month. Fails (and adds nothing) if the
+// timeline would span more than TIMELINE_MAX_DAYS, e.g. for a corrupt timestamp.
+static bool rollups_add(const Donation *donation, int day) {
+    Timeline *timeline = &aggregates.timeline;
+    const Rollup *days = &timeline->rollups[PERIOD_DAY];
+    if (days->count > 0) {
+        int first = day < days->first ? day : days->first;
+        int last = day >= days->first + days->count ? day : days->first + days->count - 1;
+        if (last - first >= TIMELINE_MAX_DAYS) return false;
+    }
+
+    // consecutive donations nearly always share their day, so its periods are remembered
+    static int cached_day = INT_MIN;
+    static int periods[PERIOD_COUNT];
+    if (day != cached_day) {
+        for (int p = 0; p < PERIOD_COUNT; p++) periods[p] = timeline_period(p, day);
+        cached_day = day;
+    }
+
+    RollupBucket *slots[PERIOD_COUNT];
+    for (int p = 0; p < PERIOD_COUNT; p++) {
+        slots[p] = rollup_slot(&timeline->rollups[p], periods[p]);
+        if (slots[p] == NULL) return false;
+    }
+    for (int p = 0; p < PERIOD_COUNT; p++) add_to_bucket(slots[p], donation);
+    return true;
+}
+
+// --- Time Index ---
+// Dated donations ordered by timestamp. Inserts are nearly always the newest donation and
+// append; an older one (an import of past forms, a kiosk with a late clock) is moved into
+// place. Only the partial days at the ends of a range query read it.
+
+static bool time_index_reserve(int needed) {
+    Timeline *timeline = &aggregates.timeline;
+    if (needed <= timeline->capacity) return true;
+    int capacity = timeline->capacity ? timeline->capacity : 1024;
+    while (capacity < needed) capacity *= 2;
+    TimeEntry *grown = realloc(timeline->by_time, capacity * sizeof(TimeEntry));
+    if (grown == NULL) return false;
+    timeline->by_time = grown;
+    timeline->capacity = capacity;
+    return true;
+}
+
+// First entry at or after timestamp.
+static int time_index_lower_bound(int64_t timestamp) {
+    const Timeline *timeline = &aggregates.timeline;
+    int low = 0, high = timeline->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (timeline->by_time[mid].timestamp < timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int compare_time_entries(const void *a, const void *b) {
+    const TimeEntry *x = a, *y = b;
+    if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp ? -1 : 1;
+    return (x->donation > y->donation) - (x->donation < y->donation);
+}
+
+static void sum_donations(int64_t from, int64_t to, RollupBucket *out) {
+    const Timeline *timeline = &aggregates.timeline;
+    for (int i = time_index_lower_bound(from); i < timeline->count && timeline->by_time[i].timestamp < to; i++) {
+        add_to_bucket(out, donation_at(timeline->by_time[i].donation));
+    }
+}
+
+// --- Timeline ---
+// Built by build_aggregates with the other totals and kept current by add_donation.
+//
+// Building appends the entries in donation order. Donations from several kiosks interleave
+// a few seconds out of order; those are slid into place within the last
+// TIMELINE_REORDER_WINDOW entries as they come. An entry older than that starts a new run,
+// as does each center section of a binary snapshot (see shards.c), and timeline_merge
+// merges the runs pairwise at the end. Past TIMELINE_MAX_RUNS the data is too shuffled for
+// runs to pay off and the appended entries are sorted instead.
+
+#define TIMELINE_REORDER_WINDOW 64
+#define TIMELINE_MAX_RUNS 512
+
+// Starts of the runs appended after the ordered part by_time[0, sorted).
+static int run_start[TIMELINE_MAX_RUNS];
+static int run_count = 0;
+static bool runs_overflow = false;
+
+static void append_entry(TimeEntry entry) {
+    Timeline *timeline = &aggregates.timeline;
+    int at = timeline->count++;
+    int first = run_count > 0 ? run_start[run_count - 1] : at;
+    int stop = at - first > TIMELINE_REORDER_WINDOW ? at - TIMELINE_REORDER_WINDOW : first;
+    if (run_count == 0 || (stop > first && timeline->by_time[stop - 1].timestamp > entry.timestamp)) {
+        if (run_count < TIMELINE_MAX_RUNS) {
+            run_start[run_count++] = at;
+        } else {
+            runs_overflow = true;
+        }
+        timeline->by_time[at] = entry;
+        return;
+    }
+    while (at > stop && timeline->by_time[at - 1].timestamp > entry.timestamp) {
+        timeline->by_time[at] = timeline->by_time[at - 1];
+        at--;
+    }
+    timeline->by_time[at] = entry;
+}
+
+// Merges the ordered ranges by_time[a, b) and by_time[b, c) through a copy of the second,
+// back to front so the first doesn't have to move out of the way.
+static void merge_runs(int a, int b, int c) {
+    TimeEntry *by_time = aggregates.timeline.by_time;
+    if (a == b || b == c || compare_time_entries(&by_time[b - 1], &by_time[b]) <= 0) return;
+    TimeEntry *second = malloc((size_t)(c - b) * sizeof(TimeEntry));
+    if (second == NULL) {
+        qsort(by_time + a, c - a, sizeof(TimeEntry), compare_time_entries);
+        return;
+    }
+    memcpy(second, by_time + b, (size_t)(c - b) * sizeof(TimeEntry));
+    int old = b - 1, add = c - b - 1, out = c - 1;
+    while (add >= 0) {
+        if (old >= a && compare_time_entries(&by_time[old], &second[add]) > 0) {
+            by_time[out--] = by_time[old--];
+        } else {
+            by_time[out--] = second[add--];
+        }
+    }
+    free(second);
+}
+
+void timeline_add(const Donation *donation, int position) {
+    Timeline *timeline = &aggregates.timeline;
+    if (donation->timestamp <= 0 || !time_index_reserve(timeline->count + 1)
+        || !rollups_add(donation, timeline_day(donation->timestamp))) {
+        add_to_bucket(&timeline->undated, donation);
+        return;
+    }
+
+    TimeEntry entry = { donation->timestamp, position };
+    int at = timeline->count;
+    if (at > 0 && timeline->by_time[at - 1].timestamp > entry.timestamp) {
+        at = time_index_lower_bound(entry.timestamp + 1);
+        memmove(timeline->by_time + at + 1, timeline->by_time + at, (timeline->count - at) * sizeof(TimeEntry));
+    }
+    timeline->by_time[at] = entry;
+    timeline->count++;
+    timeline->sorted = timeline->count;
+}
+
+// For merging a shard's donations in bulk: rolls the donation up but only appends it to the
+// time index, timeline_merge puts it in order.
+void timeline_append(const Donation *donation, int position) {
+    Timeline *timeline = &aggregates.timeline;
+    if (donation->timestamp <= 0 || !time_index_reserve(timeline->count + 1)
+        || !rollups_add(donation, timeline_day(donation->timestamp))) {
+        add_to_bucket(&timeline->undated, donation);
+        return;
+    }
+    append_entry((TimeEntry){ donation->timestamp, position });
+}
+
+// Merges the appended runs into the ordered part, pairwise so every entry moves about
+// log2(runs) times.
+void timeline_merge() {
+    Timeline *timeline = &aggregates.timeline;
+    if (runs_overflow) {
+        qsort(timeline->by_time + timeline->sorted, timeline->count - timeline->sorted, sizeof(TimeEntry), compare_time_entries);
+        run_start[0] = timeline->sorted;
+        run_count = 1;
+    }
+    int starts[TIMELINE_MAX_RUNS + 2];
+    int runs = 0;
+    if (timeline->sorted > 0) starts[runs++] = 0;
+    for (int r = 0; r < run_count; r++) starts[runs++] = run_start[r];
+    starts[runs] = timeline->count;
+
+    while (runs > 1) {
+        int merged = 0;
+        for (int r = 0; r < runs; r += 2) {
+            if (r + 1 < runs) merge_runs(starts[r], starts[r + 1], starts[r + 2]);
+            starts[merged++] = starts[r];
+        }
+        starts[merged] = timeline->count;
+        runs = merged;
+    }
+    run_count = 0;
+    runs_overflow = false;
+    timeline->sorted = timeline->count;
+}
+
+bool timeline_build() {
+    timeline_free();
+    Timeline *timeline = &aggregates.timeline;
+    if (!time_index_reserve(donations.count > 0 ? donations.count : 1)) return false;
+
+    // only the loaded centers' donations are counted (see shards.c)
+    for (int i = shard_skip(0); i < donations.count; i = shard_skip(i + 1)) {
+        const Donation *donation = donation_at(i);
+        if (donation->timestamp <= 0 || !rollups_add(donation, timeline_day(donation->timestamp))) {
+            add_to_bucket(&timeline->undated, donation);
+            continue;
+        }
+        append_entry((TimeEntry){ donation->timestamp, i });
+    }
+    timeline_merge();
+    return true;
+}
+
+void timeline_free() {
+    Timeline *timeline = &aggregates.timeline;
+    for (int p = 0; p < PERIOD_COUNT; p++) free(timeline->rollups[p].buckets);
+    free(timeline->by_time);
+    memset(timeline, 0, sizeof(*timeline));
+    run_count = 0;
+    runs_overflow = false;
+}
+
+// Totals of the donations with from <= timestamp < to. Whole months and weeks come from
+// their rollups, remaining whole days from the daily one, and only the partial days at
+// either end are summed donation by donation from the time index.
+void timeline_range(int64_t from, int64_t to, RollupBucket *out) {
+    memset(out, 0, sizeof(*out));
+    if (!aggregates.ready || from >= to) return;
+
+    int first_day = timeline_day(from);
+    if (timeline_day_start(first_day) < from) first_day++;
+    int end_day = timeline_day(to); // every day before it ends by to
+    if (first_day >= end_day) {
+        sum_donations(from, to, out);
+        return;
+    }
+
+    const Timeline *timeline = &aggregates.timeline;
+    sum_donations(from, timeline_day_start(first_day), out);
+    for (int day = first_day; day < end_day; ) {
+        int month = timeline_period(PERIOD_MONTH, day);
+        int week = timeline_period(PERIOD_WEEK, day);
+        const RollupBucket *bucket;
+        int next;
+        if (timeline_period_start(PERIOD_MONTH, month) == day && timeline_period_start(PERIOD_MONTH, month + 1) <= end_day) {
+            bucket = rollup_bucket(&timeline->rollups[PERIOD_MONTH], month);
+            next = timeline_period_start(PERIOD_MONTH, month + 1);
+        } else if (timeline_period_start(PERIOD_WEEK, week) == day && day + 7 <= end_day) {
+            bucket = rollup_bucket(&timeline->rollups[PERIOD_WEEK], week);
+            next = day + 7;
+        } else {
+            bucket = rollup_bucket(&timeline->rollups[PERIOD_DAY], day);
+            next = day + 1;
+        }
+        if (bucket != NULL) merge_bucket(out, bucket);
+        day = next;
+    }
+    sum_donations(timeline_day_start(end_day), to, out);
+}